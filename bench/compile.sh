@@ -0,0 +1,21 @@
+#!/bin/sh
+# Compiler throughput on generated programs that double in size, so the
+# scaling of each phase is visible, then all of them compiled at once on 1
+# and on threads threads (one per core by default). Results are printed and
+# written to bench/compile_results.json. Run from the repository root:
+# sh bench/compile.sh [reps] [threads]
+set -e
+REPS=${1:-3}
+THREADS=${2:-$(nproc 2>/dev/null || echo 4)}
+
+g++ -O2 -o bench/rvm_gen bench/rvm_gen.cpp
+g++ -O2 -pthread -o bench/rvm_compile_bench bench/rvm_compile_bench.cpp rvm_compiler.cpp rvm_batch.cpp rvm_tokenmap.cpp rvm_scan.cpp rvm_core.cpp rvm_verify.cpp rvm_jit.cpp rvm_symbols.cpp
+
+FILES=""
+for n in 25 50 100 200 400; do
+  f=bench/programs/gen$n.rvm
+  ./bench/rvm_gen -f $n -s 20 -l $n -d 4 > $f
+  FILES="$FILES $f"
+done
+
+./bench/rvm_compile_bench -n $REPS -j $THREADS -o bench/compile_results.json $FILES
@@ -0,0 +1,16 @@
+#!/bin/sh
+# Compares the threaded and switch dispatch engines on the same .rexe inputs.
+# Run from the repository root: sh bench/dispatch.sh [reps]
+set -e
+REPS=${1:-2000}
+
+g++ -O2 -o vm *.cpp
+g++ -O2 -o bench/rvm_bench bench/rvm_bench.cpp rvm_core.cpp rvm_verify.cpp rvm_jit.cpp
+g++ -O2 -DRVM_SWITCH_DISPATCH -o bench/rvm_bench_switch bench/rvm_bench.cpp rvm_core.cpp rvm_verify.cpp rvm_jit.cpp
+
+for f in bench/programs/*.rvm; do
+  printf '%s\nn\n' "$f" | ./vm > /dev/null
+done
+
+./bench/rvm_bench_switch -n $REPS bench/programs/*.rexe > /dev/null
+./bench/rvm_bench -n $REPS bench/programs/*.rexe > /dev/null
@@ -0,0 +1,22 @@
+#!/bin/sh
+# Spawns FIBERS fibers over the programs in bench/programs and runs them with
+# a FiberScheduler of 1 to THREADS worker threads. Total throughput should
+# grow with the worker count up to the number of cores. Results are printed
+# and written to bench/fibers_results.json. Run from the repository root:
+# sh bench/fibers.sh [threads] [fibers] [slice]
+set -e
+THREADS=${1:-$(nproc)}
+FIBERS=${2:-4000}
+SLICE=${3:-1000}
+
+g++ -O2 -pthread -o vm *.cpp
+g++ -O2 -pthread -o bench/rvm_fibers bench/rvm_fibers.cpp rvm_core.cpp rvm_fiber.cpp rvm_verify.cpp rvm_jit.cpp
+
+PROGRAMS="arith calls print expr args locals yield"
+FILES=""
+for p in $PROGRAMS; do
+  FILES="$FILES bench/programs/$p.rvm"
+done
+./vm compile -q $FILES
+
+./bench/rvm_fibers -f $FIBERS -s $SLICE -t $THREADS -o bench/fibers_results.json $(for f in $FILES; do printf '%s.rexe ' $f; done) > /dev/null
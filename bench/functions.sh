@@ -0,0 +1,20 @@
+#!/bin/sh
+# Compile time against the number of functions. Every program has the same
+# small functions, one call and one string literal each, so time per function
+# should stay flat while the symbol tables grow. Results are printed and
+# written to bench/functions_results.json. Run from the repository root:
+# sh bench/functions.sh [reps]
+set -e
+REPS=${1:-3}
+
+g++ -O2 -o bench/rvm_gen bench/rvm_gen.cpp
+g++ -O2 -pthread -o bench/rvm_compile_bench bench/rvm_compile_bench.cpp rvm_compiler.cpp rvm_batch.cpp rvm_tokenmap.cpp rvm_scan.cpp rvm_core.cpp rvm_verify.cpp rvm_jit.cpp rvm_symbols.cpp
+
+FILES=""
+for n in 1000 2000 4000 8000 16000; do
+  f=bench/programs/gen_f$n.rvm
+  ./bench/rvm_gen -f $n -s 8 -l $n -d 2 > $f
+  FILES="$FILES $f"
+done
+
+./bench/rvm_compile_bench -n $REPS -o bench/functions_results.json $FILES
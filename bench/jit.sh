@@ -0,0 +1,23 @@
+#!/bin/sh
+# Runs every program in bench/programs once with the JIT off and once with
+# every function compiled on its first call, checks both print the same and
+# end with the same operand stack and locals in main, then compares their
+# speed. Run from the repository root: sh bench/jit.sh [reps]
+set -e
+REPS=${1:-5000}
+
+g++ -O2 -o vm *.cpp
+g++ -O2 -o bench/rvm_bench bench/rvm_bench.cpp rvm_core.cpp rvm_verify.cpp rvm_jit.cpp
+
+for f in bench/programs/*.rvm; do
+  printf '%s\nn\n' "$f" | ./vm > /dev/null
+  ./bench/rvm_bench -n 1 -s 1 -j -1 "$f.rexe" > /tmp/rvm_jit_off.txt 2> /dev/null
+  ./bench/rvm_bench -n 1 -s 1 -j 0 "$f.rexe" > /tmp/rvm_jit_on.txt 2> /dev/null
+  if ! cmp -s /tmp/rvm_jit_off.txt /tmp/rvm_jit_on.txt; then
+    echo "$f: output or final state differs with the JIT" >&2
+    exit 1
+  fi
+done
+
+./bench/rvm_bench -n $REPS -j -1 bench/programs/*.rexe > /dev/null
+./bench/rvm_bench -n $REPS -j 0 bench/programs/*.rexe > /dev/null
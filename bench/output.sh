@@ -0,0 +1,48 @@
+#!/bin/sh
+# Compares PRINT output through the VM's buffer and one write per flush with
+# the printf path of a -DRVM_PRINTF_OUTPUT build, on print.rvm and a program
+# that prints 10000 strings per run. Output goes to /dev/null, a file and a
+# pipe, the buffer is tried at 0 (a write per PRINT), 4096 (the default) and
+# 65536 bytes. Run from the repository root: sh bench/output.sh [reps]
+set -e
+REPS=${1:-200}
+
+g++ -O2 -o vm *.cpp
+g++ -O2 -o bench/rvm_bench bench/rvm_bench.cpp rvm_core.cpp rvm_verify.cpp rvm_jit.cpp
+g++ -O2 -DRVM_PRINTF_OUTPUT -o bench/rvm_bench_printf bench/rvm_bench.cpp rvm_core.cpp rvm_verify.cpp rvm_jit.cpp
+
+awk -v n=50 -v calls=200 'BEGIN {
+  printf "void block()\n{\n";
+  for(i = 1; i <= n; i++)
+  {
+    s = substr("abcdefghijklmnopqrstuvwxyz0123456789", 1, 4 + (i * 7) % 30);
+    printf "  printf(\"%s%s\");\n", s, (i % 5 == 0 ? "\\n" : " ");
+  }
+  printf "}\nvoid main()\n{\n";
+  for(i = 0; i < calls; i++) printf "  block();\n";
+  printf "}\n";
+}' > bench/programs/print10000.rvm
+
+./vm compile -q bench/programs/print.rvm bench/programs/print10000.rvm
+FILES="bench/programs/print.rvm.rexe bench/programs/print10000.rvm.rexe"
+OUT=${TMPDIR:-/tmp}/rvm_output_$$.txt
+
+./bench/rvm_bench_printf -n 1 $FILES > $OUT.printf 2> /dev/null
+./bench/rvm_bench -n 1 $FILES > $OUT 2> /dev/null
+if ! cmp -s $OUT.printf $OUT; then
+  echo "buffered output differs from printf" >&2
+  exit 1
+fi
+
+for dest in null file pipe; do
+  echo "output to $dest" >&2
+  for b in printf 0 4096 65536; do
+    if [ $b = printf ]; then BENCH="./bench/rvm_bench_printf -n $REPS -r 3"; else BENCH="./bench/rvm_bench -n $REPS -r 3 -b $b"; echo "buffer $b" >&2; fi
+    case $dest in
+      null) $BENCH $FILES > /dev/null ;;
+      file) $BENCH $FILES > $OUT ;;
+      pipe) $BENCH $FILES | cat > /dev/null ;;
+    esac
+  done
+done
+rm -f $OUT $OUT.printf
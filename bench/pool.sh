@@ -0,0 +1,20 @@
+#!/bin/sh
+# Runs every bench program RUNS times as separate executions, with a new VM
+# per run and with VMs from a VMPool, each loaded from the raw bytecode and
+# from a shared Program. Results are printed and written to
+# bench/pool_results.json. Run from the repository root:
+# sh bench/pool.sh [runs]
+set -e
+RUNS=${1:-20000}
+
+g++ -O2 -pthread -o vm *.cpp
+g++ -O2 -pthread -o bench/rvm_pool bench/rvm_pool.cpp rvm_core.cpp rvm_pool.cpp rvm_verify.cpp rvm_jit.cpp
+
+PROGRAMS="arith calls print expr args locals"
+FILES=""
+for p in $PROGRAMS; do
+  FILES="$FILES bench/programs/$p.rvm"
+done
+./vm compile -q $FILES
+
+./bench/rvm_pool -n $RUNS -o bench/pool_results.json $(for f in $FILES; do printf '%s.rexe ' $f; done) > /dev/null
@@ -0,0 +1,24 @@
+#!/bin/sh
+# Call chains of increasing depth, one function per level since the language
+# has no conditional to end a recursion. Reports time per instruction and the
+# frame memory high-water mark. Run from the repository root:
+# sh bench/recursion.sh [reps]
+set -e
+REPS=${1:-200}
+
+g++ -O2 -o vm *.cpp
+g++ -O2 -o bench/rvm_bench bench/rvm_bench.cpp rvm_core.cpp rvm_verify.cpp rvm_jit.cpp
+
+FILES=""
+for depth in 10 100 1000 10000; do
+  f=bench/programs/depth$depth.rvm
+  awk -v n=$depth 'BEGIN {
+    printf "void f%d()\n{\n  int a = %d;\n}\n", n, n;
+    for(i = n - 1; i >= 1; i--) printf "void f%d()\n{\n  int a = %d;\n  f%d();\n}\n", i, i, i + 1;
+    printf "void main()\n{\n  f1();\n}\n";
+  }' > $f
+  printf '%s\nn\n' "$f" | ./vm > /dev/null
+  FILES="$FILES $f.rexe"
+done
+
+./bench/rvm_bench -n $REPS $FILES > /dev/null
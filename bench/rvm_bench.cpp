@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+#include "../rvm_core.h"
+
+using namespace std;
+
+//Loads each .rexe given on the command line once and runs it repeatedly in
+//process to report dispatch throughput.  Every program gets warmup runs, then
+//repetitions of reps runs each; the spread between repetitions shows how
+//stable a number is.  Program output goes to stdout, results go to stderr and,
+//with -o, to a JSON file, so run with >/dev/null.  -s 1 adds the operand stack
+//and last frame's locals after the final run to stdout, for comparing engines.
+
+typedef struct _BenchResult
+{
+  const char *program;
+  long long instructions; //per run
+  long long calls; //frames entered per run
+  int frameHighWater;
+  long peakRssKb;
+  vector<double> nsPerInst; //one per repetition, sorted
+  double nsPerCall; //median repetition
+  double minstPerSec;
+} BenchResult;
+
+static char *LoadRexe(const char *name, int *length)
+{
+  ifstream file(name, ios::binary);
+  if(!file.is_open()) return NULL;
+
+  file.seekg(0, file.end);
+  int filelen = file.tellg();
+  file.seekg(0, file.beg);
+
+  char *code = new char[filelen];
+  file.read(code, filelen);
+  *length = filelen;
+  return code;
+}
+
+//Largest resident set the process has had so far, 0 where unknown
+static long PeakRssKb()
+{
+#ifndef _WIN32
+  struct rusage usage;
+  if(getrusage(RUSAGE_SELF, &usage) == 0)
+  {
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024; //bytes on macOS
+#else
+    return usage.ru_maxrss;
+#endif
+  }
+#endif
+  return 0;
+}
+
+static void WriteString(FILE *file, const char *s)
+{
+  fputc('"', file);
+  for(; *s; s++)
+  {
+    if(*s == '"' || *s == '\\') fputc('\\', file);
+    fputc(*s, file);
+  }
+  fputc('"', file);
+}
+
+static bool WriteJson(const char *path, const char *engine, int warmup, int repetitions, int reps, const vector<BenchResult> &results)
+{
+  FILE *file = fopen(path, "w");
+  if(file == NULL) return false;
+
+  fprintf(file, "{\n  \"engine\": ");
+  WriteString(file, engine);
+  fprintf(file, ",\n  \"warmup\": %d,\n  \"repetitions\": %d,\n  \"runsPerRepetition\": %d,\n  \"results\": [", warmup, repetitions, reps);
+  for(size_t i1 = 0; i1 < results.size(); i1++)
+  {
+    const BenchResult &r = results[i1];
+    fprintf(file, "%s\n    {\"program\": ", i1 == 0 ? "" : ",");
+    WriteString(file, r.program);
+    fprintf(file, ", \"instructions\": %lld, \"calls\": %lld", r.instructions, r.calls);
+    fprintf(file, ", \"nsPerInst\": {\"min\": %.3f, \"median\": %.3f, \"max\": %.3f}",
+            r.nsPerInst.front(), r.nsPerInst[r.nsPerInst.size() / 2], r.nsPerInst.back());
+    fprintf(file, ", \"minstPerSec\": %.1f, \"nsPerCall\": %.2f", r.minstPerSec, r.nsPerCall);
+    fprintf(file, ", \"frameHighWaterBytes\": %d, \"peakRssKb\": %ld}", r.frameHighWater, r.peakRssKb);
+  }
+  fprintf(file, "\n  ]\n}\n");
+  return fclose(file) == 0;
+}
+
+int main(int argc, char **argv)
+{
+  int reps = 2000;
+  int warmup = -1; //reps / 10 + 1
+  int repetitions = 1;
+  int jitThreshold = RVM_JIT_THRESHOLD;
+  int outputBuffer = OUTPUT_BUFFER_SIZE;
+  bool printState = false;
+  const char *jsonPath = NULL;
+  int first = 1;
+  while(first + 1 < argc && argv[first][0] == '-')
+  {
+    if(strcmp(argv[first], "-n") == 0) reps = atoi(argv[first + 1]);
+    else if(strcmp(argv[first], "-w") == 0) warmup = atoi(argv[first + 1]);
+    else if(strcmp(argv[first], "-r") == 0) repetitions = atoi(argv[first + 1]);
+    else if(strcmp(argv[first], "-j") == 0) jitThreshold = atoi(argv[first + 1]);
+    else if(strcmp(argv[first], "-b") == 0) outputBuffer = atoi(argv[first + 1]);
+    else if(strcmp(argv[first], "-s") == 0) printState = atoi(argv[first + 1]) != 0;
+    else if(strcmp(argv[first], "-o") == 0) jsonPath = argv[first + 1];
+    else break;
+    first += 2;
+  }
+  if(first >= argc || argv[first][0] == '-' || reps < 1 || repetitions < 1)
+  {
+    fprintf(stderr, "usage: rvm_bench [-n runs per repetition] [-r repetitions] [-w warmup runs] [-j jit threshold, -1 for off] [-b output buffer bytes] [-s 1 prints the final state] [-o results.json] file.rexe...\n");
+    return 1;
+  }
+  if(warmup < 0) warmup = reps / 10 + 1;
+
+#if defined(RVM_THREADED_DISPATCH) && defined(RVM_TOS_CACHE)
+  const char *engine = "threaded+tos";
+#elif defined(RVM_THREADED_DISPATCH)
+  const char *engine = "threaded";
+#elif defined(RVM_TOS_CACHE)
+  const char *engine = "switch+tos";
+#else
+  const char *engine = "switch";
+#endif
+#ifdef RVM_JIT
+  char label[32];
+  snprintf(label, sizeof(label), "%s%s", engine, jitThreshold >= 0 ? "+jit" : "");
+  engine = label;
+#endif
+#ifdef RVM_PRINTF_OUTPUT
+  char printfLabel[40];
+  snprintf(printfLabel, sizeof(printfLabel), "%s+printf", engine);
+  engine = printfLabel;
+#endif
+
+  vector<BenchResult> results;
+  for(int i1 = first; i1 < argc; i1++)
+  {
+    int length;
+    char *bc = LoadRexe(argv[i1], &length);
+    if(bc == NULL)
+    {
+      fprintf(stderr, "%s could not be opened\n", argv[i1]);
+      return 1;
+    }
+
+    VM vm;
+    vm.setJitThreshold(jitThreshold);
+    vm.setOutput(NULL, outputBuffer);
+    vm.load(bc, length);
+    for(int i2 = 0; i2 < warmup; i2++) vm.run();
+
+    BenchResult result;
+    result.program = argv[i1];
+    result.instructions = 0;
+    result.calls = 0;
+    vector<double> nsPerCall;
+    for(int i2 = 0; i2 < repetitions; i2++)
+    {
+      long long instructions = 0;
+      long long calls = 0;
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      for(int i3 = 0; i3 < reps; i3++)
+      {
+        vm.run();
+        instructions += vm.getCycles();
+        calls += vm.getCalls();
+      }
+      double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+      result.nsPerInst.push_back(ns / instructions);
+      nsPerCall.push_back(ns / calls);
+      result.instructions = instructions / reps;
+      result.calls = calls / reps;
+    }
+    sort(result.nsPerInst.begin(), result.nsPerInst.end());
+    sort(nsPerCall.begin(), nsPerCall.end());
+    result.nsPerCall = nsPerCall[nsPerCall.size() / 2];
+    result.minstPerSec = 1e3 / result.nsPerInst[result.nsPerInst.size() / 2];
+    result.frameHighWater = vm.getFrameHighWater();
+    if(printState)
+    {
+      vector<int> state;
+      vm.getFinalState(state);
+      printf("\nfinal state of %s:", argv[i1]);
+      for(size_t i2 = 0; i2 < state.size(); i2++) printf(" %d", state[i2]);
+      printf("\n");
+      fflush(stdout);
+    }
+    result.peakRssKb = PeakRssKb();
+    results.push_back(result);
+
+    fprintf(stderr, "%-12s %-36s %8lld inst %8.2f ns/inst (%.2f-%.2f) %8.1f Minst/s %8.1f ns/call %9d frame bytes %7ld KB rss\n",
+            engine, argv[i1], result.instructions, result.nsPerInst[result.nsPerInst.size() / 2], result.nsPerInst.front(),
+            result.nsPerInst.back(), result.minstPerSec, result.nsPerCall, result.frameHighWater, result.peakRssKb);
+    delete[] bc;
+  }
+
+  if(jsonPath != NULL && !WriteJson(jsonPath, engine, warmup, repetitions, reps, results))
+  {
+    fprintf(stderr, "%s could not be written\n", jsonPath);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+#include "../rvm_compiler.h"
+
+using namespace std;
+
+//Compiles each .rvm given on the command line reps times and reports how fast
+//each compiler phase goes, in MB of source and tokens per second.  Running it
+//over programs of growing size (see compile.sh) shows how each phase scales.
+//With -j it then compiles the whole list with CompileFiles on 1 thread and on
+//the given number, to show how batch throughput scales with cores.
+
+#define PHASE_COUNT 3
+static const char *phaseNames[PHASE_COUNT] = { "tokenize", "compile", "link" };
+
+typedef chrono::steady_clock Clock;
+
+static double Seconds(Clock::time_point start, Clock::time_point end)
+{
+  return chrono::duration<double>(end - start).count();
+}
+
+//Largest resident set the process has had so far, 0 where unknown
+static long PeakRssKb()
+{
+#ifndef _WIN32
+  struct rusage usage;
+  if(getrusage(RUSAGE_SELF, &usage) == 0)
+  {
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024; //bytes on macOS
+#else
+    return usage.ru_maxrss;
+#endif
+  }
+#endif
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  int reps = 5;
+  int threads = 0; //no batch run
+  ScanLevel scanLevel = SCAN_AVX2;
+  const char *jsonPath = NULL;
+  int first = 1;
+  long totalBytes = 0;
+  while(first + 1 < argc && argv[first][0] == '-')
+  {
+    if(strcmp(argv[first], "-n") == 0) reps = atoi(argv[first + 1]);
+    else if(strcmp(argv[first], "-o") == 0) jsonPath = argv[first + 1];
+    else if(strcmp(argv[first], "-j") == 0) threads = atoi(argv[first + 1]);
+    else if(strcmp(argv[first], "-s") == 0)
+    {
+      if(strcmp(argv[first + 1], "scalar") == 0) scanLevel = SCAN_SCALAR;
+      else if(strcmp(argv[first + 1], "sse2") == 0) scanLevel = SCAN_SSE2;
+    }
+    else break;
+    first += 2;
+  }
+  if(first >= argc || argv[first][0] == '-' || reps < 1)
+  {
+    fprintf(stderr, "usage: rvm_compile_bench [-n reps] [-s scalar|sse2|avx2] [-j threads] [-o results.json] file.rvm...\n");
+    return 1;
+  }
+
+  PopulateTokenMap();
+  scanLevel = InitScanner(scanLevel);
+  fprintf(stderr, "scanner: %s\n", ScanLevelName(scanLevel));
+  FILE *json = NULL;
+  if(jsonPath != NULL)
+  {
+    json = fopen(jsonPath, "w");
+    if(json == NULL)
+    {
+      fprintf(stderr, "%s could not be written\n", jsonPath);
+      return 1;
+    }
+    fprintf(json, "{\n  \"reps\": %d,\n  \"scanner\": \"%s\",\n  \"results\": [", reps, ScanLevelName(scanLevel));
+  }
+
+  for(int i1 = first; i1 < argc; i1++)
+  {
+    SourceFile source;
+    if(!source.open(argv[i1]))
+    {
+      fprintf(stderr, "%s could not be opened\n", argv[i1]);
+      return 1;
+    }
+
+    int length = source.length;
+    totalBytes += length;
+    double secs[PHASE_COUNT] = { 0, 0, 0 };
+    int tokenCount = 0;
+    int bytecodeLength = 0;
+    try
+    {
+      for(int i2 = 0; i2 < reps; i2++)
+      {
+        Clock::time_point t0 = Clock::now();
+        vector<Token> tokens = Tokenize(source.data, source.length);
+        Clock::time_point t1 = Clock::now();
+        int capacity;
+        char *bytecode = GenerateBytecode(tokens, &bytecodeLength, &capacity);
+        Clock::time_point t2 = Clock::now();
+        LinkBytecode(&bytecode, &capacity, &bytecodeLength, NULL);
+        Clock::time_point t3 = Clock::now();
+
+        secs[0] += Seconds(t0, t1);
+        secs[1] += Seconds(t1, t2);
+        secs[2] += Seconds(t2, t3);
+        tokenCount = tokens.size();
+        delete[] bytecode;
+      }
+    }
+    catch(runtime_error &e)
+    {
+      fprintf(stderr, "%s: %s\n", argv[i1], e.what());
+      return 1;
+    }
+
+    double total = 0;
+    for(int i2 = 0; i2 < PHASE_COUNT; i2++) total += secs[i2];
+    long peakRssKb = PeakRssKb();
+    fprintf(stderr, "%-36s %9d bytes %8d tokens %7d bytecode %9.2f ms %7ld KB rss\n", argv[i1], length, tokenCount, bytecodeLength,
+            total * 1e3 / reps, peakRssKb);
+    for(int i2 = 0; i2 < PHASE_COUNT; i2++)
+    {
+      fprintf(stderr, "  %-10s %9.2f ms %10.2f MB/s %12.0f tokens/s\n", phaseNames[i2], secs[i2] * 1e3 / reps,
+              length * (double)reps / secs[i2] / 1e6, tokenCount * (double)reps / secs[i2]);
+    }
+
+    if(json != NULL)
+    {
+      fprintf(json, "%s\n    {\"program\": \"%s\", \"bytes\": %d, \"tokens\": %d, \"bytecodeBytes\": %d, \"peakRssKb\": %ld, \"phases\": {",
+              i1 == first ? "" : ",", argv[i1], length, tokenCount, bytecodeLength, peakRssKb);
+      for(int i2 = 0; i2 < PHASE_COUNT; i2++)
+      {
+        fprintf(json, "%s\"%s\": {\"ms\": %.3f, \"mbPerSec\": %.3f, \"tokensPerSec\": %.0f}", i2 == 0 ? "" : ", ", phaseNames[i2],
+                secs[i2] * 1e3 / reps, length * (double)reps / secs[i2] / 1e6, tokenCount * (double)reps / secs[i2]);
+      }
+      fprintf(json, "}}");
+    }
+  }
+
+  if(json != NULL) fprintf(json, "\n  ]");
+
+  if(threads > 0)
+  {
+    //the list reps times over, so every thread has work
+    vector<CompileJob> jobs;
+    for(int i1 = 0; i1 < reps; i1++)
+    {
+      for(int i2 = first; i2 < argc; i2++)
+      {
+        CompileJob job;
+        job.path = argv[i2];
+        jobs.push_back(job);
+      }
+    }
+
+    int counts[2] = { 1, threads };
+    double baseline = 0;
+    if(json != NULL) fprintf(json, ",\n  \"batch\": [");
+    for(int i1 = 0; i1 < (threads > 1 ? 2 : 1); i1++)
+    {
+      Clock::time_point start = Clock::now();
+      CompileFiles(jobs, counts[i1]);
+      double secs = Seconds(start, Clock::now());
+      for(size_t i2 = 0; i2 < jobs.size(); i2++)
+      {
+        if(!jobs[i2].error.empty())
+        {
+          fprintf(stderr, "%s: %s\n", jobs[i2].path.c_str(), jobs[i2].error.c_str());
+          return 1;
+        }
+        delete[] jobs[i2].bytecode;
+      }
+      if(i1 == 0) baseline = secs;
+      double mbPerSec = totalBytes * (double)reps / secs / 1e6;
+      fprintf(stderr, "batch %3d threads %9.2f ms %10.2f MB/s %8.1f files/s %6.2fx\n", counts[i1], secs * 1e3, mbPerSec,
+              jobs.size() / secs, baseline / secs);
+      if(json != NULL)
+      {
+        fprintf(json, "%s\n    {\"threads\": %d, \"ms\": %.3f, \"mbPerSec\": %.3f, \"speedup\": %.3f}", i1 == 0 ? "" : ",",
+                counts[i1], secs * 1e3, mbPerSec, baseline / secs);
+      }
+    }
+    if(json != NULL) fprintf(json, "\n  ]");
+  }
+
+  if(json != NULL)
+  {
+    fprintf(json, "\n}\n");
+    fclose(json);
+  }
+  return 0;
+}
@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <fstream>
+#include <vector>
+#include <thread>
+#include "../rvm_core.h"
+
+using namespace std;
+
+//Spawns -f fibers over the .rexe files given on the command line, in turn,
+//and runs them all with a FiberScheduler of 1, 2, ... up to -t workers.
+//Every fiber's instruction count is checked against a plain run of its
+//program.  Shows how total throughput scales with cores when many small
+//scripts share a few threads.  Program output goes to stdout, results go to
+//stderr and, with -o, to a JSON file, so run with >/dev/null.
+
+typedef chrono::steady_clock Clock;
+
+typedef struct _FiberResult
+{
+  int workers;
+  double ms;
+  double minstPerSec;
+  double speedup; //over 1 worker
+  long long slices;
+  long long steals;
+} FiberResult;
+
+static char *LoadRexe(const char *name, int *length)
+{
+  ifstream file(name, ios::binary);
+  if(!file.is_open()) return NULL;
+
+  file.seekg(0, file.end);
+  int filelen = file.tellg();
+  file.seekg(0, file.beg);
+
+  char *code = new char[filelen];
+  file.read(code, filelen);
+  *length = filelen;
+  return code;
+}
+
+static bool WriteJson(const char *path, int fiberCount, int slice, const vector<FiberResult> &results)
+{
+  FILE *file = fopen(path, "w");
+  if(file == NULL) return false;
+
+  fprintf(file, "{\n  \"fibers\": %d,\n  \"slice\": %d,\n  \"hardwareThreads\": %u,\n  \"results\": [", fiberCount, slice,
+          thread::hardware_concurrency());
+  for(size_t i1 = 0; i1 < results.size(); i1++)
+  {
+    const FiberResult &r = results[i1];
+    fprintf(file, "%s\n    {\"workers\": %d, \"ms\": %.3f, \"minstPerSec\": %.1f, \"speedup\": %.3f, \"slices\": %lld, \"steals\": %lld}",
+            i1 == 0 ? "" : ",", r.workers, r.ms, r.minstPerSec, r.speedup, r.slices, r.steals);
+  }
+  fprintf(file, "\n  ]\n}\n");
+  return fclose(file) == 0;
+}
+
+int main(int argc, char **argv)
+{
+  int fiberCount = 4000;
+  int slice = 1000;
+  int maxWorkers = thread::hardware_concurrency();
+  const char *jsonPath = NULL;
+  int first = 1;
+  while(first + 1 < argc && argv[first][0] == '-')
+  {
+    if(strcmp(argv[first], "-f") == 0) fiberCount = atoi(argv[first + 1]);
+    else if(strcmp(argv[first], "-s") == 0) slice = atoi(argv[first + 1]);
+    else if(strcmp(argv[first], "-t") == 0) maxWorkers = atoi(argv[first + 1]);
+    else if(strcmp(argv[first], "-o") == 0) jsonPath = argv[first + 1];
+    else break;
+    first += 2;
+  }
+  if(maxWorkers < 1) maxWorkers = 1; //unknown
+  if(first >= argc || argv[first][0] == '-' || fiberCount < 1 || slice < 1)
+  {
+    fprintf(stderr, "usage: rvm_fibers [-f fibers] [-s slice] [-t most workers] [-o results.json] file.rexe...\n");
+    return 1;
+  }
+
+  vector<Program*> programs;
+  vector<int> cycles;
+  for(int i1 = first; i1 < argc; i1++)
+  {
+    int length;
+    char *bc = LoadRexe(argv[i1], &length);
+    if(bc == NULL)
+    {
+      fprintf(stderr, "%s could not be opened\n", argv[i1]);
+      return 1;
+    }
+    try
+    {
+      Program *program = new Program();
+      programs.push_back(program);
+      program->load(bc, length);
+      VM vm;
+      vm.execute(*program);
+      cycles.push_back(vm.getCycles());
+    }
+    catch(exception &e)
+    {
+      fprintf(stderr, "%s: %s\n", argv[i1], e.what());
+      return 1;
+    }
+    delete[] bc;
+  }
+
+  vector<FiberResult> results;
+  double baseline = 0;
+  for(int workers = 1; workers <= maxWorkers; workers++)
+  {
+    FiberScheduler scheduler(workers, slice);
+    for(int i1 = 0; i1 < fiberCount; i1++) scheduler.spawn(*programs[i1 % programs.size()]);
+
+    Clock::time_point start = Clock::now();
+    scheduler.run();
+    double secs = chrono::duration<double>(Clock::now() - start).count();
+
+    long long instructions = 0;
+    for(int i1 = 0; i1 < fiberCount; i1++)
+    {
+      const Fiber &fiber = scheduler.getFiber(i1);
+      if(fiber.status != RUN_COMPLETED || fiber.cycles != cycles[i1 % programs.size()])
+      {
+        fprintf(stderr, "fiber %d with %d workers: %s\n", i1, workers, fiber.status == RUN_TRAPPED ? fiber.trap.c_str() : "instruction count differs from a plain run");
+        return 1;
+      }
+      instructions += fiber.cycles;
+    }
+
+    FiberResult result;
+    result.workers = workers;
+    result.ms = secs * 1e3;
+    result.minstPerSec = instructions / secs / 1e6;
+    if(workers == 1) baseline = result.minstPerSec;
+    result.speedup = result.minstPerSec / baseline;
+    result.slices = 0;
+    result.steals = 0;
+    for(int i1 = 0; i1 < workers; i1++)
+    {
+      FiberWorkerStats stats = scheduler.getWorkerStats(i1);
+      result.slices += stats.slices;
+      result.steals += stats.steals;
+    }
+    results.push_back(result);
+    fprintf(stderr, "%3d workers %9.2f ms %10.1f Minst/s %6.2fx %8lld slices %6lld steals\n", workers, result.ms, result.minstPerSec,
+            result.speedup, result.slices, result.steals);
+  }
+
+  for(size_t i1 = 0; i1 < programs.size(); i1++) delete programs[i1];
+
+  if(jsonPath != NULL && !WriteJson(jsonPath, fiberCount, slice, results))
+  {
+    fprintf(stderr, "%s could not be written\n", jsonPath);
+    return 1;
+  }
+  return 0;
+}
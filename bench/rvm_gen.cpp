@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+using namespace std;
+
+//Writes a valid .rvm program of a chosen size to stdout for compiler
+//benchmarks.  Function i takes two arguments, keeps up to 8 locals and calls
+//function i - 1 once, so the program also runs in time linear in its size.
+//The same options always produce the same program.
+
+static unsigned int seed = 12345;
+
+static int Random(int range)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) % range;
+}
+
+//Nested additions depth levels deep, (v3 + (a + (v0 + 17)))
+static string Expression(int depth, int locals)
+{
+  char leaf[16];
+  int pick = Random(locals + 3);
+  if(pick < locals) snprintf(leaf, sizeof(leaf), "v%d", pick);
+  else if(pick == locals) snprintf(leaf, sizeof(leaf), "a");
+  else if(pick == locals + 1) snprintf(leaf, sizeof(leaf), "b");
+  else snprintf(leaf, sizeof(leaf), "%d", Random(1000));
+  if(depth <= 0) return leaf;
+  return string("(") + leaf + " + " + Expression(depth - 1, locals) + ")";
+}
+
+int main(int argc, char **argv)
+{
+  int functions = 100;
+  int statements = 20;
+  int strings = 100;
+  int depth = 4;
+  for(int i1 = 1; i1 + 1 < argc; i1 += 2)
+  {
+    if(strcmp(argv[i1], "-f") == 0) functions = atoi(argv[i1 + 1]);
+    else if(strcmp(argv[i1], "-s") == 0) statements = atoi(argv[i1 + 1]);
+    else if(strcmp(argv[i1], "-l") == 0) strings = atoi(argv[i1 + 1]);
+    else if(strcmp(argv[i1], "-d") == 0) depth = atoi(argv[i1 + 1]);
+    else if(strcmp(argv[i1], "-seed") == 0) seed = atoi(argv[i1 + 1]);
+    else
+    {
+      fprintf(stderr, "usage: rvm_gen [-f functions] [-s statements per function] [-l string literals] [-d expression depth] [-seed n]\n");
+      return 1;
+    }
+  }
+  if(functions < 1 || statements < 1 || strings < 0 || depth < 0)
+  {
+    fprintf(stderr, "rvm_gen: sizes must be positive\n");
+    return 1;
+  }
+
+  int stringsLeft = strings;
+  for(int i1 = 0; i1 < functions; i1++)
+  {
+    int locals = statements < 8 ? statements : 8;
+    int stringsHere = stringsLeft / (functions - i1); //spread evenly
+    stringsLeft -= stringsHere;
+
+    printf("int f%d(int a, int b)\n{\n", i1);
+    for(int i2 = 0; i2 < locals; i2++) printf("  int v%d = %s;\n", i2, Expression(depth, i2).c_str());
+    for(int i2 = locals; i2 < statements; i2++)
+    {
+      int target = Random(locals);
+      if(i2 == locals && i1 > 0) printf("  v%d = f%d(v%d, b);\n", target, i1 - 1, Random(locals));
+      else if(stringsHere > 0 && Random(2) == 0)
+      {
+        printf("  printf(\"f%d string %d\\n\");\n", i1, stringsHere);
+        stringsHere--;
+      }
+      else printf("  v%d = %s;\n", target, Expression(depth, locals).c_str());
+    }
+    for(; stringsHere > 0; stringsHere--) printf("  printf(\"f%d string %d\\n\");\n", i1, stringsHere);
+    printf("  return v0 + a;\n}\n");
+  }
+  printf("void main()\n{\n  int r = 0;\n  r = f%d(1, 2);\n}\n", functions - 1);
+  return 0;
+}
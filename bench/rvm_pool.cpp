@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <fstream>
+#include <vector>
+#include <stdexcept>
+#include "../rvm_core.h"
+
+using namespace std;
+
+//Runs each .rexe given on the command line reps times as separate executions,
+//the way a host runs one script per request, and compares where the VM comes
+//from: a new VM for every run or one taken from a VMPool, loaded from the
+//raw bytecode or from a shared Program.  Program output goes to stdout,
+//results go to stderr and, with -o, to a JSON file, so run with >/dev/null.
+
+#define MODE_COUNT 4
+static const char *modeNames[MODE_COUNT] = { "new+bytecode", "new+program", "pool+bytecode", "pool+program" };
+
+typedef chrono::steady_clock Clock;
+
+static char *LoadRexe(const char *name, int *length)
+{
+  ifstream file(name, ios::binary);
+  if(!file.is_open()) return NULL;
+
+  file.seekg(0, file.end);
+  int filelen = file.tellg();
+  file.seekg(0, file.beg);
+
+  char *code = new char[filelen];
+  file.read(code, filelen);
+  *length = filelen;
+  return code;
+}
+
+//One execution in the given mode, returns its instruction count
+static int RunOnce(int mode, VMPool &pool, char *bc, int length, const Program &program)
+{
+  if(mode < 2)
+  {
+    VM vm;
+    if(mode == 0) vm.execute(bc, length);
+    else vm.execute(program);
+    return vm.getCycles();
+  }
+
+  VM *vm = (mode == 2 ? pool.acquire() : pool.acquire(program));
+  int cycles;
+  try
+  {
+    if(mode == 2) vm->execute(bc, length);
+    else vm->run();
+    cycles = vm->getCycles();
+  }
+  catch(...)
+  {
+    pool.release(vm);
+    throw;
+  }
+  pool.release(vm);
+  return cycles;
+}
+
+int main(int argc, char **argv)
+{
+  int reps = 20000;
+  const char *jsonPath = NULL;
+  int first = 1;
+  while(first + 1 < argc && argv[first][0] == '-')
+  {
+    if(strcmp(argv[first], "-n") == 0) reps = atoi(argv[first + 1]);
+    else if(strcmp(argv[first], "-o") == 0) jsonPath = argv[first + 1];
+    else break;
+    first += 2;
+  }
+  if(first >= argc || argv[first][0] == '-' || reps < 1)
+  {
+    fprintf(stderr, "usage: rvm_pool [-n runs] [-o results.json] file.rexe...\n");
+    return 1;
+  }
+
+  FILE *json = NULL;
+  if(jsonPath != NULL)
+  {
+    json = fopen(jsonPath, "w");
+    if(json == NULL)
+    {
+      fprintf(stderr, "%s could not be written\n", jsonPath);
+      return 1;
+    }
+    fprintf(json, "{\n  \"runs\": %d,\n  \"results\": [", reps);
+  }
+
+  VMPool pool;
+  for(int i1 = first; i1 < argc; i1++)
+  {
+    int length;
+    char *bc = LoadRexe(argv[i1], &length);
+    if(bc == NULL)
+    {
+      fprintf(stderr, "%s could not be opened\n", argv[i1]);
+      return 1;
+    }
+
+    double usPerRun[MODE_COUNT];
+    int instructions = 0;
+    try
+    {
+      Program program;
+      program.load(bc, length);
+      for(int i2 = 0; i2 < MODE_COUNT; i2++)
+      {
+        Clock::time_point start = Clock::now();
+        for(int i3 = 0; i3 < reps; i3++)
+        {
+          int cycles = RunOnce(i2, pool, bc, length, program);
+          if(instructions == 0) instructions = cycles;
+          else if(cycles != instructions) throw runtime_error("instruction count differs between runs");
+        }
+        usPerRun[i2] = chrono::duration<double, micro>(Clock::now() - start).count() / reps;
+      }
+    }
+    catch(exception &e)
+    {
+      fprintf(stderr, "%s: %s\n", argv[i1], e.what());
+      return 1;
+    }
+
+    fprintf(stderr, "%-36s %8d inst", argv[i1], instructions);
+    for(int i2 = 0; i2 < MODE_COUNT; i2++) fprintf(stderr, " %s %8.2f us", modeNames[i2], usPerRun[i2]);
+    fprintf(stderr, " %5.2fx\n", usPerRun[0] / usPerRun[MODE_COUNT - 1]);
+    if(json != NULL)
+    {
+      fprintf(json, "%s\n    {\"program\": \"%s\", \"instructions\": %d, \"usPerRun\": {", i1 == first ? "" : ",", argv[i1], instructions);
+      for(int i2 = 0; i2 < MODE_COUNT; i2++) fprintf(json, "%s\"%s\": %.3f", i2 == 0 ? "" : ", ", modeNames[i2], usPerRun[i2]);
+      fprintf(json, "}}");
+    }
+    delete[] bc;
+  }
+
+  VMPoolStats stats = pool.getStats();
+  fprintf(stderr, "pool: %lld acquires, %lld hits, %lld with the program loaded, %lld misses, %lld discarded, frame high-water %d bytes, %d idle holding %lu bytes\n",
+          stats.acquires, stats.hits, stats.programHits, stats.misses, stats.discarded, stats.frameHighWater, stats.idle,
+          (unsigned long)stats.retainedBytes);
+  if(json != NULL)
+  {
+    fprintf(json, "\n  ],\n  \"pool\": {\"acquires\": %lld, \"hits\": %lld, \"programHits\": %lld, \"misses\": %lld, \"discarded\": %lld, "
+            "\"frameHighWaterBytes\": %d, \"idle\": %d, \"retainedBytes\": %lu}\n}\n", stats.acquires, stats.hits, stats.programHits,
+            stats.misses, stats.discarded, stats.frameHighWater, stats.idle, (unsigned long)stats.retainedBytes);
+    fclose(json);
+  }
+  return 0;
+}
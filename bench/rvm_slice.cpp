@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <fstream>
+#include <vector>
+#include <stdexcept>
+#include "../rvm_core.h"
+
+using namespace std;
+
+//Runs each .rexe given on the command line to completion with VM::run and
+//then in slices through VM::execute(program, budget), for a range of
+//budgets.  Every sliced run must dispatch as many instructions and enter as
+//many frames as the plain one.  Shows what preemption costs per instruction.
+//Program output goes to stdout, results go to stderr and, with -o, to a JSON
+//file, so run with >/dev/null.
+
+#define BUDGET_COUNT 6
+static const int budgets[BUDGET_COUNT] = { 0, 10, 100, 1000, 10000, 100000 }; //0 is VM::run
+
+typedef chrono::steady_clock Clock;
+
+static char *LoadRexe(const char *name, int *length)
+{
+  ifstream file(name, ios::binary);
+  if(!file.is_open()) return NULL;
+
+  file.seekg(0, file.end);
+  int filelen = file.tellg();
+  file.seekg(0, file.beg);
+
+  char *code = new char[filelen];
+  file.read(code, filelen);
+  *length = filelen;
+  return code;
+}
+
+int main(int argc, char **argv)
+{
+  int reps = 2000;
+  const char *jsonPath = NULL;
+  int first = 1;
+  while(first + 1 < argc && argv[first][0] == '-')
+  {
+    if(strcmp(argv[first], "-n") == 0) reps = atoi(argv[first + 1]);
+    else if(strcmp(argv[first], "-o") == 0) jsonPath = argv[first + 1];
+    else break;
+    first += 2;
+  }
+  if(first >= argc || argv[first][0] == '-' || reps < 1)
+  {
+    fprintf(stderr, "usage: rvm_slice [-n runs] [-o results.json] file.rexe...\n");
+    return 1;
+  }
+
+  FILE *json = NULL;
+  if(jsonPath != NULL)
+  {
+    json = fopen(jsonPath, "w");
+    if(json == NULL)
+    {
+      fprintf(stderr, "%s could not be written\n", jsonPath);
+      return 1;
+    }
+    fprintf(json, "{\n  \"runs\": %d,\n  \"results\": [", reps);
+  }
+
+  for(int i1 = first; i1 < argc; i1++)
+  {
+    int length;
+    char *bc = LoadRexe(argv[i1], &length);
+    if(bc == NULL)
+    {
+      fprintf(stderr, "%s could not be opened\n", argv[i1]);
+      return 1;
+    }
+
+    Program program;
+    VM vm;
+    int instructions = 0;
+    int calls = 0;
+    double nsPerInst[BUDGET_COUNT];
+    double slicesPerRun[BUDGET_COUNT];
+    try
+    {
+      program.load(bc, length);
+      vm.execute(program);
+      instructions = vm.getCycles();
+      calls = vm.getCalls();
+      for(int i2 = 0; i2 < BUDGET_COUNT; i2++)
+      {
+        long long slices = 0;
+        Clock::time_point start = Clock::now();
+        for(int i3 = 0; i3 < reps; i3++)
+        {
+          if(budgets[i2] == 0)
+          {
+            vm.run();
+            slices++;
+          }
+          else
+          {
+            RunStatus status;
+            do
+            {
+              status = vm.execute(program, budgets[i2]);
+              slices++;
+            } while(status == RUN_YIELDED);
+            if(status == RUN_TRAPPED) throw runtime_error(vm.getTrap());
+          }
+          if(vm.getCycles() != instructions || vm.getCalls() != calls) throw runtime_error("sliced run differs from the plain one");
+        }
+        nsPerInst[i2] = chrono::duration<double, nano>(Clock::now() - start).count() / ((double)instructions * reps);
+        slicesPerRun[i2] = (double)slices / reps;
+      }
+    }
+    catch(exception &e)
+    {
+      fprintf(stderr, "%s: %s\n", argv[i1], e.what());
+      return 1;
+    }
+
+    fprintf(stderr, "%-36s %8d inst\n", argv[i1], instructions);
+    for(int i2 = 0; i2 < BUDGET_COUNT; i2++)
+    {
+      if(budgets[i2] == 0) fprintf(stderr, "  %-14s %8.2f ns/inst\n", "run", nsPerInst[i2]);
+      else fprintf(stderr, "  budget %-7d %8.2f ns/inst %10.1f slices/run\n", budgets[i2], nsPerInst[i2], slicesPerRun[i2]);
+    }
+    if(json != NULL)
+    {
+      fprintf(json, "%s\n    {\"program\": \"%s\", \"instructions\": %d, \"budgets\": [", i1 == first ? "" : ",", argv[i1], instructions);
+      for(int i2 = 0; i2 < BUDGET_COUNT; i2++)
+      {
+        fprintf(json, "%s{\"budget\": %d, \"nsPerInst\": %.3f, \"slicesPerRun\": %.1f}", i2 == 0 ? "" : ", ", budgets[i2],
+                nsPerInst[i2], slicesPerRun[i2]);
+      }
+      fprintf(json, "]}");
+    }
+    delete[] bc;
+  }
+
+  if(json != NULL)
+  {
+    fprintf(json, "\n  ]\n}\n");
+    fclose(json);
+  }
+  return 0;
+}
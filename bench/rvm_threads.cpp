@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <fstream>
+#include <vector>
+#include <thread>
+#include <stdexcept>
+#include "../rvm_core.h"
+
+using namespace std;
+
+//Loads each .rexe given on the command line into one Program and runs the
+//whole set on 1, 2, ... up to -t threads at once.  Every thread has its own VM
+//and they all share the same Programs, so the numbers show how execution
+//scales when a process hosts many scripts.  Each run's instruction count is
+//checked against a single threaded run.  Program output goes to stdout,
+//results go to stderr and, with -o, to a JSON file, so run with >/dev/null.
+
+typedef chrono::steady_clock Clock;
+
+typedef struct _ThreadResult
+{
+  int threads;
+  double ms;
+  double minstPerSec;
+  double speedup; //over 1 thread
+  double efficiency; //speedup per thread
+} ThreadResult;
+
+typedef struct _ThreadWork
+{
+  const vector<Program*> *programs;
+  const vector<int> *cycles; //expected instructions of one run of each program
+  int reps;
+  long long instructions;
+  string error; //empty on success
+} ThreadWork;
+
+static char *LoadRexe(const char *name, int *length)
+{
+  ifstream file(name, ios::binary);
+  if(!file.is_open()) return NULL;
+
+  file.seekg(0, file.end);
+  int filelen = file.tellg();
+  file.seekg(0, file.beg);
+
+  char *code = new char[filelen];
+  file.read(code, filelen);
+  *length = filelen;
+  return code;
+}
+
+static void RunPrograms(ThreadWork *work)
+{
+  try
+  {
+    VM vm;
+    for(int i1 = 0; i1 < work->reps; i1++)
+    {
+      for(size_t i2 = 0; i2 < work->programs->size(); i2++)
+      {
+        vm.execute(*(*work->programs)[i2]);
+        if(vm.getCycles() != (*work->cycles)[i2]) throw runtime_error("instruction count differs from the single threaded run");
+        work->instructions += vm.getCycles();
+      }
+    }
+  }
+  catch(exception &e)
+  {
+    work->error = e.what();
+  }
+}
+
+static bool WriteJson(const char *path, int reps, char **files, int fileCount, const vector<ThreadResult> &results)
+{
+  FILE *file = fopen(path, "w");
+  if(file == NULL) return false;
+
+  fprintf(file, "{\n  \"runsPerThread\": %d,\n  \"hardwareThreads\": %u,\n  \"programs\": [", reps, thread::hardware_concurrency());
+  for(int i1 = 0; i1 < fileCount; i1++) fprintf(file, "%s\"%s\"", i1 == 0 ? "" : ", ", files[i1]);
+  fprintf(file, "],\n  \"results\": [");
+  for(size_t i1 = 0; i1 < results.size(); i1++)
+  {
+    const ThreadResult &r = results[i1];
+    fprintf(file, "%s\n    {\"threads\": %d, \"ms\": %.3f, \"minstPerSec\": %.1f, \"speedup\": %.3f, \"efficiency\": %.3f}",
+            i1 == 0 ? "" : ",", r.threads, r.ms, r.minstPerSec, r.speedup, r.efficiency);
+  }
+  fprintf(file, "\n  ]\n}\n");
+  return fclose(file) == 0;
+}
+
+int main(int argc, char **argv)
+{
+  int reps = 200;
+  int maxThreads = thread::hardware_concurrency();
+  const char *jsonPath = NULL;
+  int first = 1;
+  while(first + 1 < argc && argv[first][0] == '-')
+  {
+    if(strcmp(argv[first], "-n") == 0) reps = atoi(argv[first + 1]);
+    else if(strcmp(argv[first], "-t") == 0) maxThreads = atoi(argv[first + 1]);
+    else if(strcmp(argv[first], "-o") == 0) jsonPath = argv[first + 1];
+    else break;
+    first += 2;
+  }
+  if(maxThreads < 1) maxThreads = 1; //unknown
+  if(first >= argc || argv[first][0] == '-' || reps < 1)
+  {
+    fprintf(stderr, "usage: rvm_threads [-n runs per thread] [-t most threads] [-o results.json] file.rexe...\n");
+    return 1;
+  }
+
+  vector<Program*> programs;
+  vector<int> cycles;
+  for(int i1 = first; i1 < argc; i1++)
+  {
+    int length;
+    char *bc = LoadRexe(argv[i1], &length);
+    if(bc == NULL)
+    {
+      fprintf(stderr, "%s could not be opened\n", argv[i1]);
+      return 1;
+    }
+    try
+    {
+      Program *program = new Program();
+      programs.push_back(program);
+      program->load(bc, length);
+      VM vm;
+      vm.execute(*program);
+      cycles.push_back(vm.getCycles());
+    }
+    catch(exception &e)
+    {
+      fprintf(stderr, "%s: %s\n", argv[i1], e.what());
+      return 1;
+    }
+    delete[] bc;
+  }
+
+  vector<ThreadResult> results;
+  double baseline = 0;
+  for(int threads = 1; threads <= maxThreads; threads++)
+  {
+    vector<ThreadWork> work(threads);
+    vector<thread> pool;
+    Clock::time_point start = Clock::now();
+    for(int i1 = 0; i1 < threads; i1++)
+    {
+      work[i1].programs = &programs;
+      work[i1].cycles = &cycles;
+      work[i1].reps = reps;
+      work[i1].instructions = 0;
+      pool.push_back(thread(RunPrograms, &work[i1]));
+    }
+    long long instructions = 0;
+    for(int i1 = 0; i1 < threads; i1++)
+    {
+      pool[i1].join();
+      if(!work[i1].error.empty())
+      {
+        fprintf(stderr, "thread %d of %d: %s\n", i1, threads, work[i1].error.c_str());
+        return 1;
+      }
+      instructions += work[i1].instructions;
+    }
+    double secs = chrono::duration<double>(Clock::now() - start).count();
+
+    ThreadResult result;
+    result.threads = threads;
+    result.ms = secs * 1e3;
+    result.minstPerSec = instructions / secs / 1e6;
+    if(threads == 1) baseline = result.minstPerSec;
+    result.speedup = result.minstPerSec / baseline;
+    result.efficiency = result.speedup / threads;
+    results.push_back(result);
+    fprintf(stderr, "%3d threads %9.2f ms %10.1f Minst/s %6.2fx %5.0f%% efficiency\n", threads, result.ms, result.minstPerSec,
+            result.speedup, result.efficiency * 100);
+  }
+
+  for(size_t i1 = 0; i1 < programs.size(); i1++) delete programs[i1];
+
+  if(jsonPath != NULL && !WriteJson(jsonPath, reps, argv + first, argc - first, results))
+  {
+    fprintf(stderr, "%s could not be written\n", jsonPath);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,26 @@
+#!/bin/sh
+# Runs every bench program plus a call chain 1000 frames deep to completion,
+# then in slices of 10 to 100000 instructions through
+# VM::execute(program, budget), and checks every sliced run against the plain
+# one. Results are printed and written to bench/slice_results.json. Run from
+# the repository root: sh bench/slice.sh [runs]
+set -e
+RUNS=${1:-2000}
+
+g++ -O2 -pthread -o vm *.cpp
+g++ -O2 -pthread -o bench/rvm_slice bench/rvm_slice.cpp rvm_core.cpp rvm_pool.cpp rvm_verify.cpp rvm_jit.cpp
+
+awk -v n=1000 'BEGIN {
+  printf "void f%d()\n{\n  int a = %d;\n}\n", n, n;
+  for(i = n - 1; i >= 1; i--) printf "void f%d()\n{\n  int a = %d;\n  f%d();\n}\n", i, i, i + 1;
+  printf "void main()\n{\n  f1();\n}\n";
+}' > bench/programs/depth1000.rvm
+
+PROGRAMS="arith calls print expr args locals depth1000"
+FILES=""
+for p in $PROGRAMS; do
+  FILES="$FILES bench/programs/$p.rvm"
+done
+./vm compile -q $FILES
+
+./bench/rvm_slice -n $RUNS -o bench/slice_results.json $(for f in $FILES; do printf '%s.rexe ' $f; done) > /dev/null
@@ -0,0 +1,21 @@
+#!/bin/sh
+# The baseline benchmark suite: every program in bench/programs plus a call
+# chain 1000 frames deep, each with warmup and several repetitions. Results
+# are printed and written to bench/results.json. Run from the repository root:
+# sh bench/suite.sh [runs per repetition] [repetitions]
+set -e
+REPS=${1:-2000}
+REPETITIONS=${2:-5}
+
+g++ -O2 -o vm *.cpp
+g++ -O2 -o bench/rvm_bench bench/rvm_bench.cpp rvm_core.cpp rvm_verify.cpp rvm_jit.cpp
+
+awk -v n=1000 'BEGIN {
+  printf "void f%d()\n{\n  int a = %d;\n}\n", n, n;
+  for(i = n - 1; i >= 1; i--) printf "void f%d()\n{\n  int a = %d;\n  f%d();\n}\n", i, i, i + 1;
+  printf "void main()\n{\n  f1();\n}\n";
+}' > bench/programs/depth1000.rvm
+
+./vm compile -q bench/programs/*.rvm
+
+./bench/rvm_bench -n $REPS -r $REPETITIONS -o bench/results.json bench/programs/*.rexe > /dev/null
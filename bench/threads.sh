@@ -0,0 +1,21 @@
+#!/bin/sh
+# Runs the programs in bench/programs on 1 to THREADS threads at once, one VM
+# per thread, all sharing the same loaded Programs. Throughput should grow
+# with the thread count up to the number of cores. Results are printed and
+# written to bench/threads_results.json. Run from the repository root:
+# sh bench/threads.sh [threads] [runs per thread]
+set -e
+THREADS=${1:-$(nproc)}
+REPS=${2:-2000}
+
+g++ -O2 -pthread -o vm *.cpp
+g++ -O2 -pthread -o bench/rvm_threads bench/rvm_threads.cpp rvm_core.cpp rvm_pool.cpp rvm_verify.cpp rvm_jit.cpp
+
+PROGRAMS="arith calls print expr args locals"
+FILES=""
+for p in $PROGRAMS; do
+  FILES="$FILES bench/programs/$p.rvm"
+done
+./vm compile -q $FILES
+
+./bench/rvm_threads -n $REPS -t $THREADS -o bench/threads_results.json $(for f in $FILES; do printf '%s.rexe ' $f; done) > /dev/null
@@ -0,0 +1,16 @@
+#!/bin/sh
+# Compares the interpreter with and without top-of-stack caching on the
+# expression-heavy programs. Run from the repository root: sh bench/tos.sh [reps]
+set -e
+REPS=${1:-20000}
+
+g++ -O2 -o vm *.cpp
+g++ -O2 -o bench/rvm_bench bench/rvm_bench.cpp rvm_core.cpp rvm_verify.cpp rvm_jit.cpp
+g++ -O2 -DRVM_NO_TOS_CACHE -o bench/rvm_bench_notos bench/rvm_bench.cpp rvm_core.cpp rvm_verify.cpp rvm_jit.cpp
+
+for f in bench/programs/arith.rvm bench/programs/expr.rvm; do
+  printf '%s\nn\n' "$f" | ./vm > /dev/null
+done
+
+./bench/rvm_bench_notos -n $REPS bench/programs/arith.rvm.rexe bench/programs/expr.rvm.rexe > /dev/null
+./bench/rvm_bench -n $REPS bench/programs/arith.rvm.rexe bench/programs/expr.rvm.rexe > /dev/null
@@ -0,0 +1,87 @@
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include "rvm_compiler.h"
+
+using namespace std;
+
+//Workers take the next index from a shared counter instead of a fixed share
+//of the range, so one slow item doesn't leave the other threads idle.
+
+typedef struct _ParallelWork
+{
+  void (*work)(void *data, int index, int worker);
+  void *data;
+  int count;
+  atomic<int> next;
+} ParallelWork;
+
+static void ParallelWorker(ParallelWork *parallel, int worker)
+{
+  for(int i1 = parallel->next++; i1 < parallel->count; i1 = parallel->next++) parallel->work(parallel->data, i1, worker);
+}
+
+int ThreadCount(int threads, int count)
+{
+  if(threads <= 0) threads = thread::hardware_concurrency();
+  if(threads <= 0) threads = 1; //unknown
+  if(threads > count) threads = count;
+  return (threads < 1 ? 1 : threads);
+}
+
+void ParallelFor(int count, int threads, void (*work)(void *data, int index, int worker), void *data)
+{
+  ParallelWork parallel;
+  parallel.work = work;
+  parallel.data = data;
+  parallel.count = count;
+  parallel.next = 0;
+
+  threads = ThreadCount(threads, count);
+  vector<thread> pool;
+  for(int i1 = 1; i1 < threads; i1++) pool.push_back(thread(ParallelWorker, &parallel, i1));
+  ParallelWorker(&parallel, 0); //the calling thread is worker 0
+  for(size_t i1 = 0; i1 < pool.size(); i1++) pool[i1].join();
+}
+
+typedef struct _CompileBatch
+{
+  vector<CompileJob> *jobs;
+  vector<CompilerContext*> contexts; //one per worker, reused for every file it compiles
+} CompileBatch;
+
+static void CompileJobAt(void *data, int index, int worker)
+{
+  CompileBatch *batch = (CompileBatch*)data;
+  CompileJob &job = (*batch->jobs)[index];
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  job.bytecode = NULL;
+  job.length = 0;
+  job.error.clear();
+
+  SourceFile source;
+  if(!source.open(job.path.c_str())) job.error = "File could not be opened";
+  else
+  {
+    try
+    {
+      vector<Token> tokens = Tokenize(source.data, source.length);
+      job.bytecode = CompileToBytecode(batch->contexts[worker], tokens, &job.length, &job.symbols);
+    }
+    catch(exception &e)
+    {
+      job.error = e.what();
+    }
+  }
+  job.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void CompileFiles(vector<CompileJob> &jobs, int threads)
+{
+  CompileBatch batch;
+  batch.jobs = &jobs;
+  threads = ThreadCount(threads, jobs.size());
+  for(int i1 = 0; i1 < threads; i1++) batch.contexts.push_back(new CompilerContext());
+  ParallelFor(jobs.size(), threads, CompileJobAt, &batch);
+  for(int i1 = 0; i1 < threads; i1++) delete batch.contexts[i1];
+}
@@ -6,204 +6,192 @@
 #include <vector>
 #include <iostream>
 #include <fstream>
-#include "rvm_core.h"
-#include "rvm_tokenmap.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "rvm_compiler.h"
 
 using namespace std;
 
-struct _Token
-{
-  TokenType type;
-  const char *str;
-  int length;
-  int padding;
-  bool operator==(const _Token& a) const
-  {
-    return (type == a.type && str == a.str && length == a.length && padding == a.padding);
-  }
-};
-
-typedef struct _Token Token;
-
-struct _FunctionSig
-{
-  Token returnToken;
-  Token symbolToken;
-  vector<Token> argTokens;
-  vector<Token> argTypeTokens;
-  _FunctionSig(Token rToken, Token sToken, vector<Token> aTypeTokens, vector<Token> aTokens) : returnToken(rToken), symbolToken(sToken), argTypeTokens(aTypeTokens), argTokens(aTokens)
-  {
-  }
-  bool operator==(const _FunctionSig& a) const
-  {
-    return (symbolToken == a.symbolToken); //sufficient
-  }
-};
-
-typedef struct _FunctionSig FunctionSig;
-
 typedef struct _VariableInfo
 {
   TokenType type;
-  char *name;
-  void Dealloc()
-  { 
-    if( name != NULL) { delete[] name; name = NULL; } 
-  }
+  const char *name; //interned
 } VariableInfo;
 
-bool lastCompileWasError = false;
+void CompileCodeInternal(CompilerContext *context, char **bytecode, int *bytecodeLength, int *workingOffset, Token *tokens, int tokenLength, vector<VariableInfo> *localSymbols);
+void CompileCodeInternal(CompilerContext *context, char **bytecode, int *bytecodeLength, int *workingOffset, Token *tokens, int tokenLength);
+void CompileExpression(CompilerContext *context, char **bytecode, int *bytecodeLength, int *workingOffset, Token *tokens, int tokenLength, int *consumedTokens, TokenType *resultingType, vector<VariableInfo> *localSymbols);
+void CompileExpression(CompilerContext *context, char **bytecode, int *bytecodeLength, int *workingOffset, Token *tokens, int tokenLength, int *consumedTokens, TokenType *resultingType, vector<VariableInfo> *localSymbols, bool stopAfterOne);
 
-void CompileCodeInternal(char **bytecode, int *bytecodeLength, int *workingOffset, Token *tokens, int tokenLength, vector<VariableInfo> *localSymbols);
-void CompileCodeInternal(char **bytecode, int *bytecodeLength, int *workingOffset, Token *tokens, int tokenLength);
-void CompileExpression(char **bytecode, int *bytecodeLength, int *workingOffset, Token *tokens, int tokenLength, int *consumedTokens, TokenType *resultingType, vector<VariableInfo> *localSymbols);
-void CompileExpression(char **bytecode, int *bytecodeLength, int *workingOffset, Token *tokens, int tokenLength, int *consumedTokens, TokenType *resultingType, vector<VariableInfo> *localSymbols, bool stopAfterOne);
-
-bool compareStringsMap(char *a, char *b)
+static bool compareIntsMap(int a, int b)
 {
-  return strcmp(a, b) == 0;
+  return a == b;
 }
 
-bool compareIntsMap(int a, int b)
+static bool compareNamesMap(const char *a, const char *b)
 {
   return a == b;
 }
 
-ExactMap<char*, int> symbolLocation(compareStringsMap);
-ExactMap<int, char*> jmpToFill(compareIntsMap);
-vector<FunctionSig> symbolDefines;
+static unsigned int hashNamesMap(const char *a)
+{
+  unsigned long long address = (unsigned long long)(size_t)a;
+  return HashInt((int)(address ^ (address >> 32)));
+}
+
+static unsigned int hashIntsMap(int a)
+{
+  return HashInt(a);
+}
 
-ExactMap<int, char*> stringsToFill(compareIntsMap);
+static const char *preludeCode = "void printf(string str) { asm INST_PRINT str; } \n";
 
-static inline FunctionSig *LookupFunctionSig(const char *name)
+CompilerContext::CompilerContext() : names(&arena), symbolLocation(hashNamesMap, compareNamesMap), jmpToFill(hashIntsMap, compareIntsMap),
+  symbolDefineIndex(hashNamesMap, compareNamesMap), stringsToFill(hashIntsMap, compareIntsMap), functionEnds(hashIntsMap, compareIntsMap),
+  lastCompileWasError(false), currentReturnType(TOKEN_VOID), lastReturnEnd(-1)
 {
-  for(int i1 = 0; i1 < symbolDefines.size(); i1++)
-  {
-    if(strncmp(symbolDefines[i1].symbolToken.str, name, symbolDefines[i1].symbolToken.length) == 0) return &symbolDefines[i1];
-  }
-  return NULL;
 }
 
-void SyntaxError(const char* error)
+void CompilerContext::reset()
 {
-  printf("Syntax Error: %s\n", error);
-  lastCompileWasError = true;
-  throw runtime_error("Syntax Error");
+  symbolLocation.clear();
+  jmpToFill.clear();
+  symbolDefines.clear();
+  symbolDefineIndex.clear();
+  stringsToFill.clear();
+  functionEnds.clear();
+  lineTable.clear();
+  names.clear();
+  arena.reset();
 }
 
-vector<char> PreProcessCode(const char *code)
+const char *CompilerContext::internName(const Token &token)
 {
-  int codeLen = strlen(code);
-  vector<char> newCode;
+  return names.intern(token.str, token.length);
+}
 
-  const char *helpers = "void printf(string str) { asm INST_PRINT str; } \n";
-  for(int i1 = 0; i1 < strlen(helpers)+1; i1++)
-  {
-    if(helpers[i1] == '\0') continue;
-    newCode.push_back(helpers[i1]);
-  }
-  
-  bool inComment = false;
-  for(int i1 = 0; i1 < codeLen; i1++)
-  {
-    if(inComment && code[i1] == '\n')
-    {
-      inComment = false;
-      if(i1 > 0 && code[i1-1] == '\r') newCode.push_back('\r');
-    }
-    else if(!inComment)
-    {
-      if(code[i1] == '/' && (i1 + 1 < codeLen && code[i1+1] == '/')) inComment = true;
-    }
+static CompilerContext defaultContext; //for the overloads without a context
 
-    if(inComment)
-    {
-      continue;
-    }
+static inline FunctionSig *LookupFunctionSig(CompilerContext *context, const Token &name)
+{
+  int *idx = context->symbolDefineIndex.lookup(context->internName(name));
+  return (idx == NULL ? NULL : &context->symbolDefines[*idx]);
+}
 
-    newCode.push_back(code[i1]);
-  }
-  newCode.push_back('\0');
-  return newCode;
+void SyntaxError(const char* error)
+{
+  throw runtime_error(string("Syntax Error: ") + error);
 }
 
-Token CreateToken(const char *ptr)
+//A token starts at ptr, which is not whitespace or a comment.  begin and
+//end bound the buffer ptr is in.
+static Token CreateToken(const char *ptr, const char *begin, const char *end)
 {
   Token result;
-  result.padding = 0;
   result.type = TOKEN_INVALID;
-  while(isspace(*ptr) || *ptr == '\n' || *ptr == '\r')
-  {
-    ptr++;
-    result.padding++;
-  }
-  if(*ptr == '\0') return result;
 
-  if(AnyWhereTokens.contains(ptr))
+  //one pass over the token, nothing here looks past its end
+  if(CharClasses[(unsigned char)*ptr] == CHAR_PUNCT)
   {
-    if(AnyWhereTokens[ptr] == TOKEN_QUOTE)
+    if(PunctTokens[(unsigned char)*ptr] == TOKEN_QUOTE)
     {
-      if(*(ptr - 1) == '\\') SyntaxError("Unrecongnized sequence: \\\"");
-      const char *tptr = ptr + 1;
-      while((*tptr != '\"' && *tptr != '\0') || ((*tptr == '\"' && (*(tptr - 1) == '\\')))) tptr++;
-      if(*tptr == '\0') SyntaxError("No ending quote");
+      if(ptr > begin && *(ptr - 1) == '\\') SyntaxError("Unrecongnized sequence: \\\"");
+      const char *tptr = ScanQuote(ptr + 1, end);
+      while(tptr != end && *tptr == '\\') tptr = (end - tptr > 1 ? ScanQuote(tptr + 2, end) : end); //the escaped byte is part of the string
+      if(tptr == end) SyntaxError("No ending quote");
       result.type = TOKEN_CONSTSTRING;
       result.str = ptr;
       result.length = tptr - ptr + 1; //include end quote
       return result;
     }
 
-    result.type = AnyWhereTokens[ptr];
-    result.length = strlen(AnyWhereTokensReverse[result.type]);
+    result.type = PunctTokens[(unsigned char)*ptr];
+    result.length = 1;
     result.str = ptr;
     return result;
   }
-  else if(KeywordTokens.contains(ptr))
-  {
-    result.type = KeywordTokens[ptr];
-    result.length = strlen(KeywordTokensReverse[result.type]);
-    result.str = ptr;
-    return result;
-  }
-  else if(isdigit(*ptr) || (*ptr == '.' && isdigit(*(ptr+1))))
+
+  const char *tptr = ScanWord(ptr + 1, end);
+  result.str = ptr;
+  result.length = tptr - ptr;
+
+  //a keyword must be followed by a space or punctuation, not the end of the code
+  TokenType keyword = (tptr != end && *tptr != '\0' ? MatchKeyword(ptr, result.length) : TOKEN_INVALID);
+  if(keyword != TOKEN_INVALID) result.type = keyword;
+  else if(isdigit(*ptr) || (*ptr == '.' && ptr + 1 < end && isdigit(*(ptr+1)))) result.type = TOKEN_NUMBER;
+  else result.type = TOKEN_SYMBOL; //must be a symbol whether var or func
+  return result;
+}
+
+//Moves line and column past the code in [ptr, end)
+static inline void AdvancePosition(const char *ptr, const char *end, int *line, int *column)
+{
+  for(const char *newline = ScanLine(ptr, end); newline != end; newline = ScanLine(ptr, end))
   {
-    result.type = TOKEN_NUMBER;
-    const char *tptr = ptr + 1;
-    result.str = ptr;
-    while(!isspace(*tptr) && (*tptr != '\0')  && !AnyWhereTokens.contains(tptr)) tptr++;
-    result.length = tptr - ptr;
-    return result;
+    (*line)++;
+    (*column) = 1;
+    ptr = newline + 1;
   }
-  else //must be a symbol whether var or func
+  (*column) += end - ptr;
+}
+
+//Appends the tokens in [code, end) to result, skipping // comments like
+//whitespace
+static void TokenizeBuffer(vector<Token> &result, const char *code, const char *end, int line)
+{
+  int column = 1;
+  const char *ptr = code;
+  for(;;)
   {
-    result.type = TOKEN_SYMBOL;
-    const char *tptr = ptr + 1;
-    result.str = ptr;
-    while(!isspace(*tptr) && (*tptr != '\0')  && !AnyWhereTokens.contains(tptr)) tptr++;
-    result.length = tptr - ptr;
-    return result;
+    const char *next = ScanSpace(ptr, end);
+    while(end - next >= 2 && next[0] == '/' && next[1] == '/') next = ScanSpace(ScanLine(next + 2, end), end);
+    AdvancePosition(ptr, next, &line, &column);
+    if(next == end || *next == '\0') break;
+
+    Token token = CreateToken(next, code, end);
+    token.line = line;
+    token.column = column;
+    AdvancePosition(token.str, token.str + token.length, &line, &column);
+    result.push_back(token);
+    ptr = token.str + token.length;
   }
 }
 
-vector<Token> Tokenize(const char *code)
+vector<Token> Tokenize(const char *code, int length)
 {
+  const char *nul = (const char*)memchr(code, '\0', length); //the code ends at a '\0' if it has one
+  if(nul != NULL) length = nul - code;
+
   vector<Token> result;
-  int codeLen = strlen(code);
-  for(int i1 = 0; i1 < codeLen; )
+  if(length > 64 * 1024) result.reserve(length / 2); //dense code, it grows past this if needed and pages never touched stay unmapped
+
+  int preludeLen = strlen(preludeCode);
+  int preludeLine = 1;
+  for(int i1 = 0; i1 < preludeLen; i1++)
   {
-    Token token = CreateToken(&code[i1]);
-    if(token.type == TOKEN_INVALID) break;
-    result.push_back(token);
-    i1 += token.length + token.padding;
+    if(preludeCode[i1] == '\n') preludeLine--; //so the compiled file starts at line 1
   }
+  TokenizeBuffer(result, preludeCode, preludeCode + preludeLen, preludeLine);
+  TokenizeBuffer(result, code, code + length, 1);
   return result;
 }
 
-
 void PrintToken(Token token, const char *offset)
 {
   printf("------------------\n");
-  printf("Token Type: %d\nToken Offset: %d\nToken Length: %d\nToken Start String: %s\n", token.type, token.str - offset, token.length, token.str);
+  printf("Token Type: %d\nToken Offset: %d\nToken Length: %d\nToken String: %.*s\n", token.type, (int)(token.str - offset), token.length, token.length, token.str);
+}
+
+//Copies a token into temp as a C string, cut short to fit in size bytes
+static inline void TokenText(const Token &token, char *temp, int size)
+{
+  int length = (token.length < size ? token.length : size - 1);
+  memcpy(temp, token.str, length);
+  temp[length] = '\0';
 }
 
 static inline void PrepareForWrite(char **bytecode, int *bytecodeLength, int *workingOffset, int sizeToBeWritten)
@@ -226,25 +214,25 @@ static inline bool VariableDeclared(vector<VariableInfo> &lst, VariableInfo &inf
 {
   for(int i1 = 0; i1 < lst.size(); i1++)
   {
-    if(strcmp(lst[i1].name, info.name) == 0) return true;
+    if(lst[i1].name == info.name) return true;
   }
  return false;
 }
 
-static inline VariableInfo *LookupVariable(vector<VariableInfo> &lst, char *name)
+static inline VariableInfo *LookupVariable(vector<VariableInfo> &lst, const char *name)
 {
   for(int i1 = 0; i1 < lst.size(); i1++)
   {
-    if(strcmp(lst[i1].name, name) == 0) return &lst[i1];
+    if(lst[i1].name == name) return &lst[i1];
   }
   return NULL;
 }
 
-static inline int LookupVariableIndex(vector<VariableInfo> &lst, char *name)
+static inline int LookupVariableIndex(vector<VariableInfo> &lst, const char *name)
 {
   for(int i1 = 0; i1 < lst.size(); i1++)
   {
-    if(strcmp(lst[i1].name, name) == 0) return i1;
+    if(lst[i1].name == name) return i1;
   }
   return -1;
 }
@@ -264,47 +252,62 @@ static inline bool IsFunctionDeclaration(Token *tokens, int tokenLength)
   return false;
 }
 
-void AddSymbol(FunctionSig sig)
+void AddSymbol(CompilerContext *context, const FunctionSig &sig)
 {
-  for(int i1 = 0; i1 < symbolDefines.size(); i1++)
+  const char *name = context->internName(sig.symbolToken);
+  if(context->symbolDefineIndex.contains(name))
   {
-    if(symbolDefines[i1] == sig)
-    {
-      char temp[128];
-      char temp2[36];
-      snprintf(temp2, (sig.symbolToken.length > 32 ? 32 : sig.symbolToken.length), "%s", sig.symbolToken.str);
-      snprintf(temp, 128, "Multiple definitions of %s", temp2);
-      SyntaxError((const char*) temp);
-    }
+    char temp[128];
+    snprintf(temp, 128, "Multiple definitions of %.*s", (sig.symbolToken.length > 32 ? 32 : sig.symbolToken.length), sig.symbolToken.str);
+    SyntaxError((const char*) temp);
   }
-  symbolDefines.push_back(sig);
+  context->symbolDefineIndex.set(name, context->symbolDefines.size());
+  context->symbolDefines.push_back(sig);
 }
 
-bool HandleFunctionDeclaration(char **bytecode, int *bytecodeLength, int *workingOffset, Token *tokens, int tokenLength, int *consumedTokens)
+//Finds the parameters of the declaration at tokens, storing them in types and
+//names unless those are NULL.  Returns how many there are and sets *end to the
+//index of the ')' before the body.
+static int ParseParameters(Token *tokens, int tokenLength, Token *types, Token *names, int *end)
 {
-  if(!IsFunctionDeclaration(tokens, tokenLength)) return false;
-  vector<Token> args, argTypes;
-  Token *ret, *sym;
-  ret = &tokens[0];
-  sym = &tokens[1];
-  bool endFound = false;
+  int count = 0;
   int i1 = 3;
   for(; i1 < tokenLength - 2; ) //because 2 is left paren
   {
-    if(tokens[i1].type == TOKEN_RIGHTPAREN && tokens[i1+1].type == TOKEN_LEFTBRACKET) { endFound = true; break; }
+    if(tokens[i1].type == TOKEN_RIGHTPAREN && tokens[i1+1].type == TOKEN_LEFTBRACKET)
+    {
+      *end = i1;
+      return count;
+    }
     //look for first symbol
     if(!TokenIsDataType(tokens[i1].type) || tokens[i1+1].type != TOKEN_SYMBOL)
     {
       i1++;
       continue;
     }
-    args.push_back(tokens[i1+1]);
-    argTypes.push_back(tokens[i1]);
+    if(names != NULL) names[count] = tokens[i1+1];
+    if(types != NULL) types[count] = tokens[i1];
+    count++;
     i1 += 2;
   }
-  if(!endFound) SyntaxError("No end parenthesis found for function");
+  SyntaxError("No end parenthesis found for function");
+  return 0;
+}
 
-  AddSymbol(FunctionSig(*ret, *sym, argTypes, args));
+bool HandleFunctionDeclaration(CompilerContext *context, char **bytecode, int *bytecodeLength, int *workingOffset, Token *tokens, int tokenLength, int *consumedTokens)
+{
+  if(!IsFunctionDeclaration(tokens, tokenLength)) return false;
+  Token *ret, *sym;
+  ret = &tokens[0];
+  sym = &tokens[1];
+  int i1;
+  int argCount = ParseParameters(tokens, tokenLength, NULL, NULL, &i1); //counted first so the arrays fit
+  if(argCount > 255) SyntaxError("Too many parameters for function");
+  Token *argTypes = (Token*)context->arena.alloc(argCount * sizeof(Token));
+  Token *args = (Token*)context->arena.alloc(argCount * sizeof(Token));
+  ParseParameters(tokens, tokenLength, argTypes, args, &i1);
+
+  AddSymbol(context, FunctionSig(*ret, *sym, argCount, argTypes, args));
 
   i1++; //to get into the function
   int startOffset = i1;
@@ -322,44 +325,45 @@ bool HandleFunctionDeclaration(char **bytecode, int *bytecodeLength, int *workin
   }
   if(inBracket != outBracket) SyntaxError("No end bracket");
 
-  char *str = new char[sym->length+1];
-  strncpy(str, sym->str, sym->length);
-  str[sym->length] = '\0';
-  symbolLocation.set(str, *workingOffset); //set symbol location here
+  const char *str = context->internName(*sym);
+  context->symbolLocation.set(str, *workingOffset); //set symbol location here
 
   PrepareForWrite(bytecode, bytecodeLength, workingOffset, 4);
-  (*bytecode)[(*workingOffset)++] = INST_PUSHFRAME;
+  (*bytecode)[(*workingOffset)++] = INST_ENTER;
+  int frameSizeOffset = (*workingOffset)++; //filled in once the body is compiled
 
   vector<VariableInfo> stackVars;
+  stackVars.reserve(argCount + 16); //most functions never grow it
 
-  for(int i1 = args.size() - 1; i1 >= 0; i1--) //need to go backwards for loading onto stack
+  for(int i1 = 0; i1 < argCount; i1++) //INST_CALL moves argument n into local n
   {
-    char *name = new char[args[i1].length + 1];
-    strncpy(name, args[i1].str, args[i1].length);
-    name[args[i1].length] = '\0';
     VariableInfo info;
-    info.name = name;
+    info.name = context->internName(args[i1]);
     info.type = argTypes[i1].type;
 
     stackVars.push_back(info);
-
-    unsigned char idx = (unsigned char)stackVars.size() - 1;
-    PrepareForWrite(bytecode, bytecodeLength, workingOffset, 4);
-    (*bytecode)[(*workingOffset)++] = INST_PUSHVAR;
-    (*bytecode)[(*workingOffset)++] = INST_POPA; //put a stack var on and pop the value into it
-    (*bytecode)[(*workingOffset)++] = *(char*)&idx;
   }
 
-  CompileCodeInternal(bytecode, bytecodeLength, workingOffset, tokens + startOffset, totalTokens, &stackVars);
+  TokenType outerReturnType = context->currentReturnType;
+  context->currentReturnType = ret->type;
+  CompileCodeInternal(context, bytecode, bytecodeLength, workingOffset, tokens + startOffset, totalTokens, &stackVars);
+  context->currentReturnType = outerReturnType;
+
+  (*bytecode)[frameSizeOffset] = (char)stackVars.size(); //arguments and locals, at most 255
 
-  for(int i1 = 0; i1 < stackVars.size(); i1++)
+  if(*workingOffset != context->lastReturnEnd) //falls off the end, non-void functions return 0
   {
-    stackVars[i1].Dealloc();
+    PrepareForWrite(bytecode, bytecodeLength, workingOffset, 6);
+    if(ret->type != TOKEN_VOID)
+    {
+      (*bytecode)[(*workingOffset)++] = INST_PUSH;
+      INT2BYTES(0, &((*bytecode)[*workingOffset]));
+      (*workingOffset) += 4;
+    }
+    (*bytecode)[(*workingOffset)++] = INST_RET;
   }
-  stackVars.clear();
 
-  PrepareForWrite(bytecode, bytecodeLength, workingOffset, 4);
-  (*bytecode)[(*workingOffset)++] = INST_POPFRAME;
+  context->functionEnds.set(context->symbolLocation[str], *workingOffset);
 
   (*consumedTokens) += totalTokens + startOffset; //startOffset has arg tokens and stuff
 
@@ -379,12 +383,10 @@ static inline bool IsVariableAssignment(Token *tokens, int tokenLength)
   return false;
 }
 
-bool HandleVariableAssignment(char **bytecode, int *bytecodeLength, int *workingOffset, Token *tokens, int tokenLength, int *consumedTokens, vector<VariableInfo> *localSymbols)
+bool HandleVariableAssignment(CompilerContext *context, char **bytecode, int *bytecodeLength, int *workingOffset, Token *tokens, int tokenLength, int *consumedTokens, vector<VariableInfo> *localSymbols)
 {
   if(!IsVariableAssignment(tokens, tokenLength)) return false;
-  char *name = new char[tokens[0].length+1];
-  strncpy(name, tokens[0].str, tokens[0].length);
-  name[tokens[0].length] = '\0';
+  const char *name = context->internName(tokens[0]);
   VariableInfo *info;
   if(!(info = LookupVariable(*localSymbols, name))) SyntaxError("Variable used but not declared");
 
@@ -403,7 +405,7 @@ bool HandleVariableAssignment(char **bytecode, int *bytecodeLength, int *working
   }
   if(!foundEnd) SyntaxError("No end to assignment");
 
-  CompileExpression(bytecode, bytecodeLength, workingOffset, tokens + 2, totalTokens, consumedTokens, &info->type, localSymbols);
+  CompileExpression(context, bytecode, bytecodeLength, workingOffset, tokens + 2, totalTokens, consumedTokens, &info->type, localSymbols);
 
   unsigned char idx = (unsigned char)LookupVariableIndex(*localSymbols, name);
 
@@ -427,12 +429,12 @@ static inline bool IsFunctionCall(Token *tokens, int tokenLength)
   return false;
 }
 
-bool HandleFunctionCall(char **bytecode, int *bytecodeLength, int *workingOffset, Token *tokens, int tokenLength, int *consumedTokens, vector<VariableInfo> *localSymbols)
+bool HandleFunctionCall(CompilerContext *context, char **bytecode, int *bytecodeLength, int *workingOffset, Token *tokens, int tokenLength, int *consumedTokens, vector<VariableInfo> *localSymbols)
 {
   if(!IsFunctionCall(tokens, tokenLength)) return false;
 
   FunctionSig *sig;
-  if(!(sig = LookupFunctionSig(tokens[0].str))) SyntaxError("Call to undefined symbol"); //safe because LookupFunctionSig uses length of stored symbols, not arg passed
+  if(!(sig = LookupFunctionSig(context, tokens[0]))) SyntaxError("Call to undefined symbol");
 
   (*consumedTokens) += 2;
 
@@ -444,8 +446,8 @@ bool HandleFunctionCall(char **bytecode, int *bytecodeLength, int *workingOffset
     {
       (*consumedTokens)++;
       if(runningTokens == 0) break;
-      if(currentArg >= sig->argTokens.size()) SyntaxError("Too many arguments for function");
-      CompileExpression(bytecode, bytecodeLength, workingOffset, &tokens[i1 - runningTokens], runningTokens, consumedTokens, &(sig->argTypeTokens[currentArg].type), localSymbols); //will push on stack
+      if(currentArg >= sig->argCount) SyntaxError("Too many arguments for function");
+      CompileExpression(context, bytecode, bytecodeLength, workingOffset, &tokens[i1 - runningTokens], runningTokens, consumedTokens, &(sig->argTypeTokens[currentArg].type), localSymbols); //will push on stack
       runningTokens = 0;
       break;
     }
@@ -453,8 +455,8 @@ bool HandleFunctionCall(char **bytecode, int *bytecodeLength, int *workingOffset
     {
       (*consumedTokens)++;
       if(runningTokens == 0) SyntaxError("No argument specified");
-      if(currentArg >= sig->argTokens.size()) SyntaxError("Too many arguments for function");
-      CompileExpression(bytecode, bytecodeLength, workingOffset, &tokens[i1 - runningTokens], runningTokens, consumedTokens, &(sig->argTypeTokens[currentArg].type), localSymbols); //will push on stack
+      if(currentArg >= sig->argCount) SyntaxError("Too many arguments for function");
+      CompileExpression(context, bytecode, bytecodeLength, workingOffset, &tokens[i1 - runningTokens], runningTokens, consumedTokens, &(sig->argTypeTokens[currentArg].type), localSymbols); //will push on stack
       runningTokens = 0;
       currentArg++;
     }
@@ -464,15 +466,13 @@ bool HandleFunctionCall(char **bytecode, int *bytecodeLength, int *workingOffset
     }
   }
 
-  if(sig->argTokens.size() > 0 && currentArg != (int)(sig->argTokens.size() - 1)) SyntaxError("Too few arguments to function");
+  if(sig->argCount > 0 && currentArg != sig->argCount - 1) SyntaxError("Too few arguments to function");
 
-  PrepareForWrite(bytecode, bytecodeLength, workingOffset, 5);
-  (*bytecode)[(*workingOffset)++] = INST_JMP;
-  char *name = new char[tokens[0].length + 1];
-  strncpy(name, tokens[0].str, tokens[0].length);
-  name[tokens[0].length] = '\0';
-  jmpToFill.set((*workingOffset), name);
+  PrepareForWrite(bytecode, bytecodeLength, workingOffset, 6);
+  (*bytecode)[(*workingOffset)++] = INST_CALL;
+  context->jmpToFill.set((*workingOffset), context->internName(tokens[0]));
   (*workingOffset) += 4;
+  (*bytecode)[(*workingOffset)++] = (char)sig->argCount;
 
   return true;
 }
@@ -492,39 +492,35 @@ static inline bool IsVariableDeclaration(Token *tokens, int tokenLength)
 }
 
 
-bool HandleVariableDeclaration(char **bytecode, int *bytecodeLength, int *workingOffset, Token *tokens, int tokenLength, int *consumedTokens, vector<VariableInfo> *localSymbols)
+bool HandleVariableDeclaration(CompilerContext *context, char **bytecode, int *bytecodeLength, int *workingOffset, Token *tokens, int tokenLength, int *consumedTokens, vector<VariableInfo> *localSymbols)
 {
   if(!IsVariableDeclaration(tokens, tokenLength)) return false;
 
   VariableInfo var;
   var.type = tokens[0].type;
-  char *name = new char[tokens[1].length+1];
-  strncpy(name, tokens[1].str, tokens[1].length);
-  name[tokens[1].length] = '\0';
-  var.name = name;
-  PrepareForWrite(bytecode, bytecodeLength, workingOffset, 4);
+  var.name = context->internName(tokens[1]);
   if(VariableDeclared(*localSymbols, var)) SyntaxError("Variable declared more than once");
 
-  localSymbols->push_back(var);
-  (*bytecode)[(*workingOffset)++] = INST_PUSHVAR;
+  if(localSymbols->size() >= 255) SyntaxError("Too many local variables in function"); //indexes are one byte
+  localSymbols->push_back(var); //ENTER reserves and zeroes the slot
 
   (*consumedTokens) += 2;
 
   if(tokens[2].type == TOKEN_ENDSTATEMENT) return true;
 
   (*consumedTokens)--; //workaround for the following
-  if(!HandleVariableAssignment(bytecode, bytecodeLength, workingOffset, tokens + 1, tokenLength - 1, consumedTokens, localSymbols)) SyntaxError("Unknown variable operation");
+  if(!HandleVariableAssignment(context, bytecode, bytecodeLength, workingOffset, tokens + 1, tokenLength - 1, consumedTokens, localSymbols)) SyntaxError("Unknown variable operation");
 
   return true;
 }
 
 
-void CompileExpression(char **bytecode, int *bytecodeLength, int *workingOffset, Token *tokens, int tokenLength, int *consumedTokens, TokenType *resultingType, vector<VariableInfo> *localSymbols)
+void CompileExpression(CompilerContext *context, char **bytecode, int *bytecodeLength, int *workingOffset, Token *tokens, int tokenLength, int *consumedTokens, TokenType *resultingType, vector<VariableInfo> *localSymbols)
 {
-  CompileExpression(bytecode, bytecodeLength, workingOffset, tokens, tokenLength, consumedTokens, resultingType, localSymbols, false);
+  CompileExpression(context, bytecode, bytecodeLength, workingOffset, tokens, tokenLength, consumedTokens, resultingType, localSymbols, false);
 }
 
-void CompileExpression(char **bytecode, int *bytecodeLength, int *workingOffset, Token *tokens, int tokenLength, int *consumedTokens, TokenType *resultingType, vector<VariableInfo> *localSymbols, bool stopAfterOne)
+void CompileExpression(CompilerContext *context, char **bytecode, int *bytecodeLength, int *workingOffset, Token *tokens, int tokenLength, int *consumedTokens, TokenType *resultingType, vector<VariableInfo> *localSymbols, bool stopAfterOne)
 {
   if(tokenLength == 0) SyntaxError("Invalid expression.  Cannot be empty");
 
@@ -555,16 +551,16 @@ void CompileExpression(char **bytecode, int *bytecodeLength, int *workingOffset,
       if(i2 == tokenLength) SyntaxError("No end parenthesis in expression");
       totalToks -= 2; //since we don't want end parens
       TokenType dataType = TOKEN_INVALID;
-      CompileExpression(bytecode, bytecodeLength, workingOffset, tokens + i1 + 1, totalToks, consumedTokens, &dataType, localSymbols);
+      CompileExpression(context, bytecode, bytecodeLength, workingOffset, tokens + i1 + 1, totalToks, consumedTokens, &dataType, localSymbols);
       (*consumedTokens)++; //for end paren
+      i1 = i2; //skip what was just compiled
     }
     else if(tokens[i1].type == TOKEN_NUMBER) //someday change this to a const instead of always pushing //ALSO THIS ALWAYS ASSUMES INT FOR NOW
     {
       PrepareForWrite(bytecode, bytecodeLength, workingOffset, 5);
       (*bytecode)[(*workingOffset)++] = INST_PUSH;
       char temp[32];
-      strncpy(temp, tokens[i1].str, tokens[i1].length);
-      temp[tokens[i1].length] = '\0';
+      TokenText(tokens[i1], temp, sizeof(temp));
       int number = atoi(temp);
       INT2BYTES(number, &((*bytecode)[*workingOffset]));
       (*workingOffset) += 4;
@@ -578,7 +574,8 @@ void CompileExpression(char **bytecode, int *bytecodeLength, int *workingOffset,
     {
       //get expression following this one
       TokenType dataType = TOKEN_INVALID;
-      CompileExpression(bytecode, bytecodeLength, workingOffset, tokens + i1 + 1, tokenLength, consumedTokens, &dataType, localSymbols, true); //stop after one
+      int consumedBefore = (*consumedTokens);
+      CompileExpression(context, bytecode, bytecodeLength, workingOffset, tokens + i1 + 1, tokenLength - i1 - 1, consumedTokens, &dataType, localSymbols, true); //stop after one
       char mathOp;
       switch(tokens[i1].type) //RIGHT NOW THIS ONLY DOES SIGNED INTS
       {
@@ -600,33 +597,30 @@ void CompileExpression(char **bytecode, int *bytecodeLength, int *workingOffset,
 
       PrepareForWrite(bytecode, bytecodeLength, workingOffset, 2);
       (*bytecode)[(*workingOffset)++] = mathOp;
+
+      i1 += (*consumedTokens - consumedBefore); //the operand was compiled above
     }
     else if(tokens[i1].type == TOKEN_CONSTSTRING)
     {
-      vector<char> processedString;
+      char *str = (char*)context->arena.alloc(tokens[i1].length - 1); //escapes only make it shorter
+      int strLength = 0;
       for(int i2 = 1; i2 < tokens[i1].length - 1; i2++) //skip first and last quote
       {
         if(tokens[i1].str[i2] == '\\')
         {
           int len;
-          char c = ProcessEscape(&(tokens[i1].str[i2]), &len);
-          processedString.push_back(c);
+          str[strLength++] = ProcessEscape(&(tokens[i1].str[i2]), &len);
           i2 += len;
         }
         else
         {
-          processedString.push_back(tokens[i1].str[i2]);
+          str[strLength++] = tokens[i1].str[i2];
         }
       }
-      char *str = new char[processedString.size() + 1];
-      if(processedString.size() > 0) //DO THIS CHECK FOR ALL OF strncpy
-      {
-        strncpy(str, &processedString[0], processedString.size());
-      }
-      str[processedString.size()] = '\0';
+      str[strLength] = '\0';
       PrepareForWrite(bytecode, bytecodeLength, workingOffset, 5);
       (*bytecode)[(*workingOffset)++] = INST_PUSHC;
-      stringsToFill.set(*workingOffset, str);
+      context->stringsToFill.set(*workingOffset, str);
       (*workingOffset) += 4;
 
       if(*resultingType == TOKEN_INVALID)
@@ -637,9 +631,9 @@ void CompileExpression(char **bytecode, int *bytecodeLength, int *workingOffset,
     else if(tokens[i1].type == TOKEN_SYMBOL)
     {
       int consumedBefore = (*consumedTokens);
-      if(HandleFunctionCall(bytecode, bytecodeLength, workingOffset, &tokens[i1], tokenLength - i1, consumedTokens, localSymbols))
+      if(HandleFunctionCall(context, bytecode, bytecodeLength, workingOffset, &tokens[i1], tokenLength - i1, consumedTokens, localSymbols))
       {
-        FunctionSig *fsig = LookupFunctionSig(tokens[i1].str);
+        FunctionSig *fsig = LookupFunctionSig(context, tokens[i1]);
         if((tokens[i1-1].type == TOKEN_ENDSTATEMENT || tokens[i1-1].type == TOKEN_LEFTBRACKET) && fsig->returnToken.type != TOKEN_VOID)
         {
           (*bytecode)[(*workingOffset)++] = INST_POP; //for those that return something but it's not used.  Just get rid of it.
@@ -650,12 +644,10 @@ void CompileExpression(char **bytecode, int *bytecodeLength, int *workingOffset,
       else
       {
         //must be variable
-        char temp[32];
-        strncpy(temp, tokens[i1].str, tokens[i1].length);
-        temp[tokens[i1].length] = '\0';
-        VariableInfo *info = LookupVariable(*localSymbols, temp);
+        const char *name = context->internName(tokens[i1]);
+        VariableInfo *info = LookupVariable(*localSymbols, name);
         if(info == NULL) SyntaxError("Undefined symbol in expression");
-        unsigned char idx = (unsigned char)LookupVariableIndex(*localSymbols, temp);
+        unsigned char idx = (unsigned char)LookupVariableIndex(*localSymbols, name);
         PrepareForWrite(bytecode, bytecodeLength, workingOffset, 5);
         (*bytecode)[(*workingOffset)++] = INST_PUSHA;
         (*bytecode)[(*workingOffset)++] = *(char*)&idx;
@@ -673,7 +665,7 @@ void CompileExpression(char **bytecode, int *bytecodeLength, int *workingOffset,
   }
 }
 
-bool HandleKeywordStatement(char **bytecode, int *bytecodeLength, int *workingOffset, Token *tokens, int tokenLength, int *consumedTokens, vector<VariableInfo> *localSymbols)
+bool HandleKeywordStatement(CompilerContext *context, char **bytecode, int *bytecodeLength, int *workingOffset, Token *tokens, int tokenLength, int *consumedTokens, vector<VariableInfo> *localSymbols)
 {
   if(tokens[0].type == TOKEN_RETURN)
   {
@@ -686,9 +678,15 @@ bool HandleKeywordStatement(char **bytecode, int *bytecodeLength, int *workingOf
       if(tokens[i1].type == TOKEN_ENDSTATEMENT)
       {
         TokenType dataType = TOKEN_INVALID;
-        if(totalTokens == 0) break;
         foundEnd = true;
-        CompileExpression(bytecode, bytecodeLength, workingOffset, &tokens[1], totalTokens, consumedTokens, &dataType, localSymbols);
+        if(totalTokens == 0)
+        {
+          if(context->currentReturnType != TOKEN_VOID) SyntaxError("Function must return a value");
+          (*consumedTokens)++;
+          break;
+        }
+        if(context->currentReturnType == TOKEN_VOID) SyntaxError("Void function cannot return a value");
+        CompileExpression(context, bytecode, bytecodeLength, workingOffset, &tokens[1], totalTokens, consumedTokens, &dataType, localSymbols);
         (*consumedTokens)++;
         break;
       }
@@ -697,6 +695,11 @@ bool HandleKeywordStatement(char **bytecode, int *bytecodeLength, int *workingOf
     }
     if(!foundEnd) SyntaxError("No end to return statement found");
 
+    //the value, if any, is left on the operand stack for the caller
+    PrepareForWrite(bytecode, bytecodeLength, workingOffset, 2);
+    (*bytecode)[(*workingOffset)++] = INST_RET;
+    context->lastReturnEnd = *workingOffset;
+
 
     return true;
   }
@@ -706,13 +709,13 @@ bool HandleKeywordStatement(char **bytecode, int *bytecodeLength, int *workingOf
   }
 }
 
-bool HandleAsmStatement(char **bytecode, int *bytecodeLength, int *workingOffset, Token *tokens, int tokenLength, int *consumedTokens, vector<VariableInfo> *localSymbols)
+bool HandleAsmStatement(CompilerContext *context, char **bytecode, int *bytecodeLength, int *workingOffset, Token *tokens, int tokenLength, int *consumedTokens, vector<VariableInfo> *localSymbols)
 {
   if(tokens[0].type != TOKEN_ASM) return false;
+  if(tokenLength < 2) SyntaxError("Missing instruction in asm statement");
 
   char temp[32];
-  strncpy(temp, tokens[1].str, tokens[1].length);
-  temp[tokens[1].length] = '\0';
+  TokenText(tokens[1], temp, sizeof(temp));
 
   (*consumedTokens) += 2;
 
@@ -730,7 +733,7 @@ bool HandleAsmStatement(char **bytecode, int *bytecodeLength, int *workingOffset
       (*consumedTokens)++;
       if(totalTokens == 0) break;
       TokenType dataType = TOKEN_INVALID;
-      CompileExpression(bytecode, bytecodeLength, workingOffset, &tokens[i1 - totalTokens], totalTokens, consumedTokens, &dataType, localSymbols); //will push on stack
+      CompileExpression(context, bytecode, bytecodeLength, workingOffset, &tokens[i1 - totalTokens], totalTokens, consumedTokens, &dataType, localSymbols); //will push on stack
       totalTokens = 0;
       break;
     }
@@ -739,7 +742,7 @@ bool HandleAsmStatement(char **bytecode, int *bytecodeLength, int *workingOffset
       (*consumedTokens)++;
       if(totalTokens == 0) SyntaxError("No argument specified");
       TokenType dataType = TOKEN_INVALID;
-      CompileExpression(bytecode, bytecodeLength, workingOffset, &tokens[i1 - totalTokens], totalTokens, consumedTokens, &dataType, localSymbols); //will push on stack
+      CompileExpression(context, bytecode, bytecodeLength, workingOffset, &tokens[i1 - totalTokens], totalTokens, consumedTokens, &dataType, localSymbols); //will push on stack
       totalTokens = 0;
     }
     totalTokens++;
@@ -752,7 +755,19 @@ bool HandleAsmStatement(char **bytecode, int *bytecodeLength, int *workingOffset
   return true;
 }
 
-void CompileCodeInternal(char **bytecode, int *bytecodeLength, int *workingOffset, Token *tokens, int tokenLength, vector<VariableInfo> *localSymbols)
+//Remembers where the code for a statement starts, for the symbol file
+static inline void RecordLine(CompilerContext *context, int offset, Token &token)
+{
+  if(token.line <= 0) return; //prelude
+  LineEntry entry;
+  entry.address = offset;
+  entry.line = token.line;
+  entry.column = token.column;
+  if(!context->lineTable.empty() && (int)context->lineTable.back().address == offset) context->lineTable.back() = entry; //previous statement emitted nothing
+  else context->lineTable.push_back(entry);
+}
+
+void CompileCodeInternal(CompilerContext *context, char **bytecode, int *bytecodeLength, int *workingOffset, Token *tokens, int tokenLength, vector<VariableInfo> *localSymbols)
 {
   //index of local symbol is address
   for(int i1 = 0; i1 < tokenLength; /*i1++*/)
@@ -763,193 +778,397 @@ void CompileCodeInternal(char **bytecode, int *bytecodeLength, int *workingOffse
       continue;
     }
 
+    RecordLine(context, *workingOffset, tokens[i1]);
+
     int consumedTokens = 0;
     bool handled = false;
-    handled = HandleFunctionDeclaration(bytecode, bytecodeLength, workingOffset, tokens + i1, tokenLength - i1, &consumedTokens);
-    if(!handled) handled = HandleFunctionCall(bytecode, bytecodeLength, workingOffset, tokens + i1, tokenLength - i1, &consumedTokens, localSymbols);
-    if(!handled) handled = HandleVariableDeclaration(bytecode, bytecodeLength, workingOffset, tokens + i1, tokenLength - i1, &consumedTokens, localSymbols);
-    if(!handled) handled = HandleVariableAssignment(bytecode, bytecodeLength, workingOffset, tokens + i1, tokenLength - i1, &consumedTokens, localSymbols);
-    if(!handled) handled = HandleAsmStatement(bytecode, bytecodeLength, workingOffset, tokens + i1, tokenLength - i1, &consumedTokens, localSymbols);
-    if(!handled) handled = HandleKeywordStatement(bytecode, bytecodeLength, workingOffset, tokens + i1, tokenLength - i1, &consumedTokens, localSymbols);
+    handled = HandleFunctionDeclaration(context, bytecode, bytecodeLength, workingOffset, tokens + i1, tokenLength - i1, &consumedTokens);
+    if(!handled)
+    {
+      handled = HandleFunctionCall(context, bytecode, bytecodeLength, workingOffset, tokens + i1, tokenLength - i1, &consumedTokens, localSymbols);
+      if(handled && LookupFunctionSig(context, tokens[i1])->returnToken.type != TOKEN_VOID)
+      {
+        PrepareForWrite(bytecode, bytecodeLength, workingOffset, 2);
+        (*bytecode)[(*workingOffset)++] = INST_POP; //result not used
+      }
+    }
+    if(!handled) handled = HandleVariableDeclaration(context, bytecode, bytecodeLength, workingOffset, tokens + i1, tokenLength - i1, &consumedTokens, localSymbols);
+    if(!handled) handled = HandleVariableAssignment(context, bytecode, bytecodeLength, workingOffset, tokens + i1, tokenLength - i1, &consumedTokens, localSymbols);
+    if(!handled) handled = HandleAsmStatement(context, bytecode, bytecodeLength, workingOffset, tokens + i1, tokenLength - i1, &consumedTokens, localSymbols);
+    if(!handled) handled = HandleKeywordStatement(context, bytecode, bytecodeLength, workingOffset, tokens + i1, tokenLength - i1, &consumedTokens, localSymbols);
 
     if(consumedTokens == 0) consumedTokens++; //nothing was consumed, but keep moving forward
     i1 += consumedTokens;
   }
 }
 
-void CompileCodeInternal(char **bytecode, int *bytecodeLength, int *workingOffset, Token *tokens, int tokenLength)
+void CompileCodeInternal(CompilerContext *context, char **bytecode, int *bytecodeLength, int *workingOffset, Token *tokens, int tokenLength)
 {
   vector<VariableInfo> junk;
-  CompileCodeInternal(bytecode, bytecodeLength, workingOffset, tokens, tokenLength, &junk);
-  for(int i1 = 0; i1 < junk.size(); i1++)
-    junk[i1].Dealloc();
-  junk.clear();
+  CompileCodeInternal(context, bytecode, bytecodeLength, workingOffset, tokens, tokenLength, &junk);
+}
+
+static inline bool MatchOps(const char *ops, int count, char a, char b)
+{
+  return count >= 2 && ops[0] == a && ops[1] == b;
+}
+
+static inline bool MatchOps(const char *ops, int count, char a, char b, char c)
+{
+  return count >= 3 && ops[0] == a && ops[1] == b && ops[2] == c;
+}
+
+static inline bool MatchOps(const char *ops, int count, char a, char b, char c, char d)
+{
+  return count >= 4 && ops[0] == a && ops[1] == b && ops[2] == c && ops[3] == d;
+}
+
+//Fuses common instruction sequences into superinstructions.  Runs on the code
+//before linking, so function entries, call sites and string references are
+//moved along with it.  A function entry is never folded into the middle of a
+//superinstruction.
+void PeepholeOptimize(CompilerContext *context, char *bytecode, int *codeLength)
+{
+  int length = *codeLength;
+  for(int i1 = 0; i1 < length; ) //asm statements can emit anything, leave such code alone
+  {
+    int len = InstructionLength(bytecode[i1]);
+    if(len == 0 || i1 + len > length) return;
+    i1 += len;
+  }
+
+  vector<char> isEntry(length + 1, 0);
+  for(int i1 = 0; i1 < context->symbolLocation.size(); i1++) isEntry[context->symbolLocation.getAtIndex(i1).second] = 1;
+
+  vector<char> out;
+  vector<int> newOffset(length + 1, 0);
+  for(int i1 = 0; i1 < length; )
+  {
+    char ops[4];
+    int at[4];
+    int count = 0;
+    for(int pos = i1; count < 4 && pos < length && (count == 0 || !isEntry[pos]); pos += InstructionLength(bytecode[pos]))
+    {
+      ops[count] = bytecode[pos];
+      at[count++] = pos;
+    }
+
+    int used = 1;
+    newOffset[i1] = out.size();
+    if(MatchOps(ops, count, INST_PUSHA, INST_PUSHA, INST_ADDS, INST_POPA))
+    {
+      out.push_back(INST_ADDAAPOPA);
+      out.push_back(bytecode[at[0] + 1]);
+      out.push_back(bytecode[at[1] + 1]);
+      out.push_back(bytecode[at[3] + 1]);
+      used = 4;
+    }
+    else if(MatchOps(ops, count, INST_PUSHA, INST_PUSH, INST_ADDS, INST_POPA))
+    {
+      out.push_back(INST_ADDACPOPA);
+      out.push_back(bytecode[at[0] + 1]);
+      out.insert(out.end(), &bytecode[at[1] + 1], &bytecode[at[1] + 5]);
+      out.push_back(bytecode[at[3] + 1]);
+      used = 4;
+    }
+    else if(MatchOps(ops, count, INST_PUSHA, INST_PUSHA, INST_ADDS))
+    {
+      out.push_back(INST_ADDAA);
+      out.push_back(bytecode[at[0] + 1]);
+      out.push_back(bytecode[at[1] + 1]);
+      used = 3;
+    }
+    else if(MatchOps(ops, count, INST_PUSHA, INST_PUSH, INST_ADDS))
+    {
+      out.push_back(INST_ADDAC);
+      out.push_back(bytecode[at[0] + 1]);
+      out.insert(out.end(), &bytecode[at[1] + 1], &bytecode[at[1] + 5]);
+      used = 3;
+    }
+    else if(MatchOps(ops, count, INST_PUSHVAR, INST_PUSH, INST_POPA))
+    {
+      out.push_back(INST_DECLC);
+      out.push_back(bytecode[at[2] + 1]);
+      out.insert(out.end(), &bytecode[at[1] + 1], &bytecode[at[1] + 5]);
+      used = 3;
+    }
+    else if(MatchOps(ops, count, INST_PUSHA, INST_ADDS, INST_POPA))
+    {
+      out.push_back(INST_ADDAPOPA);
+      out.push_back(bytecode[at[0] + 1]);
+      out.push_back(bytecode[at[2] + 1]);
+      used = 3;
+    }
+    else if(MatchOps(ops, count, INST_PUSH, INST_ADDS, INST_POPA))
+    {
+      out.push_back(INST_ADDCPOPA);
+      out.insert(out.end(), &bytecode[at[0] + 1], &bytecode[at[0] + 5]);
+      out.push_back(bytecode[at[2] + 1]);
+      used = 3;
+    }
+    else if(MatchOps(ops, count, INST_PUSHA, INST_ADDS))
+    {
+      out.push_back(INST_ADDA);
+      out.push_back(bytecode[at[0] + 1]);
+      used = 2;
+    }
+    else if(MatchOps(ops, count, INST_PUSH, INST_ADDS))
+    {
+      out.push_back(INST_ADDC);
+      out.insert(out.end(), &bytecode[at[0] + 1], &bytecode[at[0] + 5]);
+      used = 2;
+    }
+    else if(MatchOps(ops, count, INST_ADDS, INST_POPA))
+    {
+      out.push_back(INST_ADDSPOPA);
+      out.push_back(bytecode[at[1] + 1]);
+      used = 2;
+    }
+    else if(MatchOps(ops, count, INST_PUSHVAR, INST_POPA))
+    {
+      out.push_back(INST_DECLPOPA);
+      out.push_back(bytecode[at[1] + 1]);
+      used = 2;
+    }
+    else if(MatchOps(ops, count, INST_PUSHA, INST_POPA))
+    {
+      out.push_back(INST_MOVA);
+      out.push_back(bytecode[at[0] + 1]);
+      out.push_back(bytecode[at[1] + 1]);
+      used = 2;
+    }
+    else if(MatchOps(ops, count, INST_PUSH, INST_POPA))
+    {
+      out.push_back(INST_SETC);
+      out.push_back(bytecode[at[1] + 1]);
+      out.insert(out.end(), &bytecode[at[0] + 1], &bytecode[at[0] + 5]);
+      used = 2;
+    }
+    else if(MatchOps(ops, count, INST_PUSHA, INST_PRINT))
+    {
+      out.push_back(INST_PRINTA);
+      out.push_back(bytecode[at[0] + 1]);
+      used = 2;
+    }
+    else
+    {
+      out.insert(out.end(), &bytecode[i1], &bytecode[i1 + InstructionLength(bytecode[i1])]);
+    }
+
+    for(int i2 = 1; i2 < used; i2++) newOffset[at[i2]] = newOffset[i1]; //statements starting inside a fused instruction
+    i1 = at[used - 1] + InstructionLength(ops[used - 1]);
+  }
+  newOffset[length] = out.size();
+
+  if(out.size() > 0) memcpy(bytecode, &out[0], out.size());
+  *codeLength = out.size();
+
+  for(int i1 = 0; i1 < context->symbolLocation.size(); i1++)
+  {
+    pair<const char*, int> &p = context->symbolLocation.getAtIndex(i1);
+    p.second = newOffset[p.second];
+  }
+  for(int i1 = 0; i1 < context->jmpToFill.size(); i1++) //keys are operand offsets
+  {
+    pair<int, const char*> &p = context->jmpToFill.getAtIndex(i1);
+    p.first = newOffset[p.first - 1] + 1;
+  }
+  context->jmpToFill.reindex();
+  for(int i1 = 0; i1 < context->stringsToFill.size(); i1++)
+  {
+    pair<int, const char*> &p = context->stringsToFill.getAtIndex(i1);
+    p.first = newOffset[p.first - 1] + 1;
+  }
+  context->stringsToFill.reindex();
+  for(int i1 = 0; i1 < context->functionEnds.size(); i1++)
+  {
+    pair<int, int> &p = context->functionEnds.getAtIndex(i1);
+    p.first = newOffset[p.first];
+    p.second = newOffset[p.second];
+  }
+  context->functionEnds.reindex();
+  vector<LineEntry> lines;
+  for(size_t i1 = 0; i1 < context->lineTable.size(); i1++)
+  {
+    LineEntry entry = context->lineTable[i1];
+    entry.address = newOffset[entry.address];
+    if(lines.empty() || lines.back().address != entry.address) lines.push_back(entry);
+  }
+  context->lineTable.swap(lines);
 }
 
-char *CompileToBytecode(vector<Token> &tokens, int *outputLength)
+//symbols, if not NULL, receives the range of every function and where each
+//statement's code starts
+char *GenerateBytecode(CompilerContext *context, vector<Token> &tokens, int *outputLength, int *capacity)
 {
   //STILL NEED TO PREPROCESS
 #define INITIALCODESIZE 128
   char *bytecode = new char[INITIALCODESIZE];
   int bytecodeLength = INITIALCODESIZE;
   int workingOffset = 0;
-  symbolLocation.clear();
-  jmpToFill.clear();
-  symbolDefines.clear();
-  stringsToFill.clear();
+  context->reset(); //in case the last compilation was never linked
 
-  bytecode[workingOffset++] = INST_JMP;
-  char *mainstr = new char[5];
-  strcpy(mainstr, "main");
-  jmpToFill.set(workingOffset, mainstr); //set where main will need to be filled
-  workingOffset += 4;
+  context->lastCompileWasError = false;
+  context->lastReturnEnd = -1;
+  context->currentReturnType = TOKEN_VOID;
 
-  CompileCodeInternal(&bytecode, &bytecodeLength, &workingOffset, &tokens[0], tokens.size());
+  try
+  {
+    bytecode[workingOffset++] = INST_CALL;
+    context->jmpToFill.set(workingOffset, context->names.intern("main", 4)); //set where main will need to be filled
+    workingOffset += 4;
+    bytecode[workingOffset++] = 0; //main takes no arguments
+
+    CompileCodeInternal(context, &bytecode, &bytecodeLength, &workingOffset, &tokens[0], tokens.size());
+
+    PeepholeOptimize(context, bytecode, &workingOffset);
+  }
+  catch(...)
+  {
+    context->lastCompileWasError = true;
+    context->reset();
+    delete[] bytecode;
+    throw;
+  }
+
+  *outputLength = workingOffset;
+  *capacity = bytecodeLength;
+  return bytecode;
+}
+
+void LinkBytecode(CompilerContext *context, char **bytecodeRef, int *capacity, int *outputLength, SymbolTable *symbols)
+{
+  char *bytecode = *bytecodeRef;
+  int bytecodeLength = *capacity;
+  int workingOffset = *outputLength;
 
   //PUT IN HALT
 
-  for(int i1 = 0; i1 < jmpToFill.size(); i1++)
+  for(int i1 = 0; i1 < context->jmpToFill.size(); i1++)
   {
-    pair<int, char*> p = jmpToFill.getAtIndex(i1);
-    if(!symbolLocation.contains(p.second))
+    pair<int, const char*> p = context->jmpToFill.getAtIndex(i1);
+    if(!context->symbolLocation.contains(p.second))
     {
       char temp[64];
-      strcpy(temp, p.second);
-      strcat(temp, " was not found");
+      snprintf(temp, 64, "%s was not found", p.second);
+      context->lastCompileWasError = true;
+      context->reset();
       SyntaxError(temp); //really a linker error
     }
-    INT2BYTES(symbolLocation[p.second], &bytecode[p.first]);
-    delete[] p.second;
+    INT2BYTES(context->symbolLocation[p.second], &bytecode[p.first]);
+  }
+  if(symbols != NULL)
+  {
+    symbols->functions.clear();
+    symbols->lines = context->lineTable;
+  }
+  for(int i1 = 0; i1 < context->symbolLocation.size(); i1++)
+  {
+    pair<const char*, int> &p = context->symbolLocation.getAtIndex(i1);
+    if(symbols != NULL)
+    {
+      Symbol symbol;
+      snprintf(symbol.name, sizeof(symbol.name), "%s", p.first);
+      symbol.address = p.second;
+      symbol.end = context->functionEnds.contains(p.second) ? context->functionEnds[p.second] : p.second;
+      symbols->functions.push_back(symbol);
+    }
   }
-  for(int i1 = 0; i1 < symbolLocation.size(); i1++) delete[] symbolLocation.getAtIndex(i1).first;
 
-  for(int i1 = 0; i1 < stringsToFill.size(); i1++)
+  for(int i1 = 0; i1 < context->stringsToFill.size(); i1++)
   {
-    pair<int, char*> p = stringsToFill.getAtIndex(i1);
+    pair<int, const char*> p = context->stringsToFill.getAtIndex(i1);
     PrepareForWrite(&bytecode, &bytecodeLength, &workingOffset, strlen(p.second) + 2);
     strncpy(&bytecode[workingOffset], p.second, strlen(p.second) + 1);
     INT2BYTES(workingOffset, &bytecode[p.first]);
     workingOffset += strlen(p.second) + 1;
-    delete[] p.second;
   }
+  context->reset();
 
-
+  *bytecodeRef = bytecode;
+  *capacity = bytecodeLength;
   *outputLength = workingOffset;
-  return bytecode;
 }
 
-char *readFileByteCode(char *exe, int *length)
+char *CompileToBytecode(CompilerContext *context, vector<Token> &tokens, int *outputLength, SymbolTable *symbols)
 {
-  ifstream file(exe);
-  if(!file.is_open())
+  int capacity;
+  char *bytecode = GenerateBytecode(context, tokens, outputLength, &capacity);
+  try
   {
-    printf("File could not be opened\n");
-    system("Pause");
-    return NULL;
+    LinkBytecode(context, &bytecode, &capacity, outputLength, symbols);
   }
+  catch(...)
+  {
+    delete[] bytecode;
+    throw;
+  }
+  return bytecode;
+}
 
-  file.seekg(0, file.end);
-  int filelen = file.tellg();
-  file.seekg(0, file.beg);
-
-  char *code = new char[filelen + 1];
-  file.read(code, filelen);
+char *GenerateBytecode(vector<Token> &tokens, int *outputLength, int *capacity)
+{
+  return GenerateBytecode(&defaultContext, tokens, outputLength, capacity);
+}
 
-  *length = filelen;
-  return code;
+void LinkBytecode(char **bytecode, int *capacity, int *outputLength, SymbolTable *symbols)
+{
+  LinkBytecode(&defaultContext, bytecode, capacity, outputLength, symbols);
 }
 
-int main(int argc, char **argv)
+char *CompileToBytecode(vector<Token> &tokens, int *outputLength, SymbolTable *symbols)
 {
-  PopulateTokenMap();
+  return CompileToBytecode(&defaultContext, tokens, outputLength, symbols);
+}
 
-  if(argc > 2 && strcmp("-run", argv[1]) == 0)
+bool SourceFile::open(const char *path)
+{
+  close();
+#ifndef _WIN32
+  int fd = ::open(path, O_RDONLY);
+  if(fd < 0) return false;
+  struct stat info;
+  if(fstat(fd, &info) != 0)
   {
-    char *exe = argv[2];
-
-    int length;
-    char *bc = readFileByteCode(exe, &length);
-    if(bc == NULL)
-      return 1;
-
-    VM vm;
-    vm.execute(bc, length);
-
-    delete[] bc;
-
-    int junk;
-    scanf("%d\n", &junk);
-    return 0;
+    ::close(fd);
+    return false;
   }
-
-  char filename[1024];
-  printf("Enter name of file to compile: ");
-  fgets(filename, 1024, stdin);
-
-  if(filename[strlen(filename) - 1] == '\n')
-    filename[strlen(filename) - 1] = '\0';
-
-  ifstream file(filename);
-  if(!file.is_open())
+  length = (int)info.st_size;
+  if(length > 0) //mmap refuses an empty mapping
   {
-    printf("File could not be opened\n");
-    system("Pause");
-    return 0;
+    void *map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map != MAP_FAILED)
+    {
+      ::close(fd);
+      data = (const char*)map;
+      mapped = true;
+      return true;
+    }
   }
-
+  ::close(fd);
+#endif
+  ifstream file(path, ios::binary);
+  if(!file.is_open()) return false;
   file.seekg(0, file.end);
-  int filelen = file.tellg();
+  length = (int)file.tellg();
   file.seekg(0, file.beg);
+  char *copy = new char[length];
+  file.read(copy, length);
+  data = copy;
+  return true;
+}
 
-  char *code = new char[filelen + 1];
-  file.read(code, filelen);
-
-  code[file.gcount()] = '\0';
-
-  if((strlen(code)>0) && (code[strlen(code) - 1] == '\n'))
-    code[strlen(code) - 1] = '\0';
-
-  vector<char> vec = PreProcessCode(code);
-
-  vector<Token> tokens = Tokenize(&vec[0]);
-  /*
-  for(int i1 = 0; i1 < tokens.size(); i1++)
-  {
-    PrintToken(tokens[i1], code);
-  }
-  */
-  printf("Compiling to bytecode...\n");
-  int length;
-  char *bytecode = CompileToBytecode(tokens, &length);
-  {
-    char outName[1024];
-    strcpy(outName, filename);
-    strcat(outName, ".rexe");
-    ofstream out(outName);
-    out.write(bytecode, length);
-    out.close();
-  }
-  printf("0x");
-  for(int i1 = 0; i1 < length; i1++)
-  {
-    printf("%02x", bytecode[i1]);
-  }
-  printf("\nWould you like to execute this code (y/n)? ");
-  char c;
-  scanf(" %c", &c);
-  printf("\n");
-  if(c == 'y')
-  {
-    VM vm;
-    vm.execute(bytecode, length);
-  }
-  delete[] bytecode;
+void SourceFile::close()
+{
+  if(data != NULL)
   {
-    int junk;
-    scanf("%d\n", &junk);
+#ifndef _WIN32
+    if(mapped) munmap((void*)data, length);
+    else
+#endif
+    delete[] data;
   }
-  return 0;
+  data = NULL;
+  length = 0;
+  mapped = false;
 }
-
-
-
@@ -0,0 +1,122 @@
+#ifndef _RVM_COMPILER
+#define _RVM_COMPILER
+
+#include <vector>
+#include <string>
+#include "rvm_core.h"
+#include "rvm_tokenmap.h"
+
+struct _Token
+{
+  const char *str; //into the source or the prelude, neither is copied
+  TokenType type;
+  int length;
+  int line; //position in the compiled file, 0 or less in the prelude
+  int column;
+  bool operator==(const _Token& a) const
+  {
+    return (type == a.type && str == a.str && length == a.length);
+  }
+};
+
+typedef struct _Token Token;
+
+//A source file mapped read only where the platform allows, read into memory
+//otherwise.  Not '\0' terminated.
+class SourceFile
+{
+public:
+  SourceFile() : data(NULL), length(0), mapped(false) {}
+  ~SourceFile() { close(); }
+  bool open(const char *path);
+  void close();
+  const char *data;
+  int length;
+
+private:
+  bool mapped;
+};
+
+typedef struct _FunctionSig
+{
+  Token returnToken;
+  Token symbolToken;
+  int argCount;
+  Token *argTokens; //argCount of each, in the context's arena
+  Token *argTypeTokens;
+  _FunctionSig(Token rToken, Token sToken, int aCount, Token *aTypeTokens, Token *aTokens) : returnToken(rToken), symbolToken(sToken), argCount(aCount), argTokens(aTokens), argTypeTokens(aTypeTokens)
+  {
+  }
+} FunctionSig;
+
+//Everything one compilation writes.  Contexts share nothing but the token
+//tables PopulateTokenMap fills, which are only read, so each thread can
+//compile with its own context.  A context can be reused; GenerateBytecode
+//starts by emptying it.
+class CompilerContext
+{
+public:
+  CompilerContext();
+  void reset(); //empties the tables and frees the arena
+  const char *internName(const Token &token);
+
+  //names and string literals live in arena until the compilation ends or
+  //fails.  Names are interned, so the tables compare them by pointer.
+  Arena arena;
+  InternTable names;
+
+  //every table grows with the number of functions, calls and strings, so
+  //they are hashed
+  HashMap<const char*, int> symbolLocation;
+  HashMap<int, const char*> jmpToFill;
+  std::vector<FunctionSig> symbolDefines;
+  HashMap<const char*, int> symbolDefineIndex; //name to index in symbolDefines
+  HashMap<int, const char*> stringsToFill;
+  HashMap<int, int> functionEnds; //start offset to end offset
+  std::vector<LineEntry> lineTable;
+
+  bool lastCompileWasError;
+  TokenType currentReturnType; //of the function being compiled
+  int lastReturnEnd; //offset just past the last INST_RET written for a return statement
+
+private:
+  CompilerContext(const CompilerContext&);
+  CompilerContext& operator=(const CompilerContext&);
+};
+
+//The compiler runs in three phases.  PopulateTokenMap must have been called
+//once before any of them.  Errors throw runtime_error with the message.
+//Names and strings are kept in an arena from GenerateBytecode until
+//LinkBytecode returns or either phase throws.
+std::vector<Token> Tokenize(const char *code, int length); //the prelude's tokens then code's, comments skipped; code must outlive the tokens
+char *GenerateBytecode(CompilerContext *context, std::vector<Token> &tokens, int *outputLength, int *capacity); //unlinked, peephole optimized
+void LinkBytecode(CompilerContext *context, char **bytecode, int *capacity, int *outputLength, SymbolTable *symbols); //fills calls and strings
+char *CompileToBytecode(CompilerContext *context, std::vector<Token> &tokens, int *outputLength, SymbolTable *symbols); //GenerateBytecode and LinkBytecode, symbols may be NULL
+
+//The same with one context shared by the whole process, for one thread
+char *GenerateBytecode(std::vector<Token> &tokens, int *outputLength, int *capacity);
+void LinkBytecode(char **bytecode, int *capacity, int *outputLength, SymbolTable *symbols);
+char *CompileToBytecode(std::vector<Token> &tokens, int *outputLength, SymbolTable *symbols);
+
+//One file for CompileFiles
+typedef struct _CompileJob
+{
+  std::string path;
+  char *bytecode; //new[], NULL if the file could not be read or compiled
+  int length;
+  SymbolTable symbols;
+  std::string error; //empty on success
+  double seconds; //wall time spent on this file
+} CompileJob;
+
+//Compiles every job's path on a pool of threads, each with its own
+//CompilerContext (rvm_batch.cpp).  threads 0 uses one per core.
+void CompileFiles(std::vector<CompileJob> &jobs, int threads);
+
+//Calls work for every index below count on up to threads threads, the
+//calling thread included.  worker is below ThreadCount(threads, count) and no
+//two calls with the same worker run at once.
+void ParallelFor(int count, int threads, void (*work)(void *data, int index, int worker), void *data);
+int ThreadCount(int threads, int count); //threads 0 is one per core, never more than count or less than 1
+
+#endif
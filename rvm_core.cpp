@@ -1,19 +1,54 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <errno.h>
 #include <stdexcept>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 #include "rvm_core.h"
 
 using namespace std;
 
-std::map<const char*, char, cmpStr> *instructionList = NULL;
+typedef struct _InstructionName
+{
+  const char *name;
+  char value;
+} InstructionName;
+
+//Constant, so looking names up needs no setup and is safe from any thread
+static const InstructionName instructionNames[] =
+{
+#define INSTRUCTION(name,value) { #name, value },
+#include "rvm_instructions.h"
+#undef INSTRUCTION
+};
+
+static const int instructionCount = sizeof(instructionNames) / sizeof(instructionNames[0]);
 
 char GetInstructionByName(const char *instr)
 {
-  if(instructionList->find(instr) != instructionList->end()) return instructionList->at(instr);
+  for(int i1 = 0; i1 < instructionCount; i1++)
+  {
+    if(strcmp(instructionNames[i1].name, instr) == 0) return instructionNames[i1].value;
+  }
   return 0;
 }
 
+const char *GetInstructionName(int inst)
+{
+  if(inst == DECODED_HALT) return "HALT";
+  if(inst == DECODED_INVALID) return "INVALID";
+  for(int i1 = 0; i1 < instructionCount; i1++)
+  {
+    if((unsigned char)instructionNames[i1].value == inst) return instructionNames[i1].name;
+  }
+  return "UNKNOWN";
+}
+
 int ExpandBytes(char **ptr, int currentLength)
 {
   char *newData = new char[currentLength*2];
@@ -23,14 +58,6 @@ int ExpandBytes(char **ptr, int currentLength)
   return currentLength*2;
 }
 
-void ExpandIfNeeded(char **ptr, int *size, int currentLength, int toAdd)
-{
-  if(currentLength + toAdd >= *size)
-  {
-    (*size) = ExpandBytes(ptr, *size);
-  }
-}
-
 //assumes first char is '\'
 char ProcessEscape(const char *str, int *len)
 {
@@ -44,136 +71,1030 @@ char ProcessEscape(const char *str, int *len)
 void VM::push(int value)
 {
   if(stackSize >= MAX_STACK) throw runtime_error("Stack Overflow Exception");
-  stack[stackSize++] = value;
+  stack[++stackSize] = value;
 }
 
 int VM::pop()
 {
   if(stackSize <= 0) throw runtime_error("Stack Underflow Exception");
-  return stack[--stackSize];
+  return stack[stackSize--];
+}
+
+FrameSegment *VM::NewSegment(int size)
+{
+  FrameSegment *segment = new FrameSegment;
+  segment->next = NULL;
+  segment->size = size;
+  segment->data = new char[size];
+  frameMemory += size;
+  return segment;
+}
+
+//Segment after the current one with room for at least size bytes.  Segments
+//past the current one hold no live frames, so one that is too small for an
+//unusually large frame is replaced.  Growing past frameLimit throws, which
+//ends the run like a stack overflow.
+FrameSegment *VM::NextSegment(int size)
+{
+  FrameSegment *next = currentSegment->next;
+  if(next != NULL && next->size < size)
+  {
+    currentSegment->next = next->next;
+    frameMemory -= next->size;
+    delete[] next->data;
+    delete next;
+    next = NULL;
+  }
+  if(next == NULL)
+  {
+    if(size < FRAME_SEGMENT_SIZE) size = FRAME_SEGMENT_SIZE;
+    if(size > frameLimit - frameMemory) throw runtime_error("Frame Limit Exceeded Exception");
+    next = NewSegment(size);
+    next->next = currentSegment->next;
+    currentSegment->next = next;
+  }
+  return next;
+}
+
+//Length in bytes of an instruction including its operands, 0 if unknown
+int InstructionLength(char inst)
+{
+  switch(inst)
+  {
+    case INST_PUSH:
+    case INST_PUSHC:
+    case INST_JMP:
+    case INST_ADDC:
+      return 5;
+    case INST_ADDACPOPA:
+      return 7;
+    case INST_ADDAC:
+    case INST_SETC:
+    case INST_ADDCPOPA:
+    case INST_DECLC:
+    case INST_CALL:
+      return 6;
+    case INST_ADDAAPOPA:
+      return 4;
+    case INST_MOVA:
+    case INST_ADDAA:
+    case INST_ADDAPOPA:
+      return 3;
+    case INST_PUSHA:
+    case INST_POPA:
+    case INST_DECLPOPA:
+    case INST_ADDA:
+    case INST_PRINTA:
+    case INST_ADDSPOPA:
+    case INST_ENTER:
+      return 2;
+    case INST_NOP:
+    case INST_ADDS:
+    case INST_SUBS:
+    case INST_MULTS:
+    case INST_DIVS:
+    case INST_ADDSF:
+    case INST_SUBSF:
+    case INST_MULTSF:
+    case INST_DIVSF:
+    case INST_PRINT:
+    case INST_POP:
+    case INST_PUSHFRAME:
+    case INST_POPFRAME:
+    case INST_PUSHVAR:
+    case INST_CONCATSTRINGSTRING:
+    case INST_RET:
+    case INST_YIELD:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+//Translates bytecode into a stream of DecodedInstruction.  Only code reachable
+//from offset 0 is decoded (string constants share the buffer), following both
+//the target and the return point of every jump.  The result is ordered by
+//offset and always ends with a DECODED_HALT that out of range jumps resolve to.
+void DecodeBytecode(char *bytecode, int size, vector<DecodedInstruction> &out, vector<int> &offsets)
+{
+  vector<char> seen(size + 1, 0);
+  vector<int> starts;
+  vector<int> pending;
+  pending.push_back(0);
+  pending.push_back(size);
+
+  while(!pending.empty())
+  {
+    int offset = pending.back();
+    pending.pop_back();
+    if(offset < 0 || offset > size) offset = size;
+    if(seen[offset]) continue;
+    seen[offset] = 1;
+    starts.push_back(offset);
+
+    if(offset == size) continue;
+    int len = InstructionLength(bytecode[offset]);
+    if(len == 0 || offset + len > size) continue;
+
+    if(bytecode[offset] == INST_JMP || bytecode[offset] == INST_CALL) pending.push_back(BYTES2INT(&bytecode[offset + 1]));
+    if(bytecode[offset] != INST_POPFRAME && bytecode[offset] != INST_RET) pending.push_back(offset + len); //calls come back here
+  }
+
+  vector<int> index(size + 1, -1);
+  for(int i1 = 0, i2 = 0; i1 <= size; i1++)
+  {
+    if(seen[i1]) index[i1] = i2++;
+  }
+
+  out.clear();
+  out.resize(starts.size());
+  offsets.resize(starts.size());
+  for(int i1 = 0; i1 <= size; i1++)
+  {
+    if(!seen[i1]) continue;
+    offsets[index[i1]] = i1;
+    DecodedInstruction &inst = out[index[i1]];
+    inst.handler = NULL;
+    inst.operand = 0;
+    inst.operand2 = 0;
+    inst.operand3 = 0;
+
+    if(i1 == size)
+    {
+      inst.opcode = DECODED_HALT;
+      continue;
+    }
+
+    int len = InstructionLength(bytecode[i1]);
+    if(len == 0 || i1 + len > size)
+    {
+      inst.opcode = DECODED_INVALID;
+      continue;
+    }
+    for(int i2 = i1 + 1; i2 < i1 + len; i2++)
+    {
+      if(seen[i2])
+      {
+        char message[96];
+        snprintf(message, sizeof(message), "Verify Error at offset %d: jump into the middle of an instruction", i2);
+        throw runtime_error(message);
+      }
+    }
+
+    char *op = &bytecode[i1 + 1];
+    inst.opcode = (unsigned char)bytecode[i1];
+    switch(bytecode[i1])
+    {
+      case INST_POP:
+      case INST_ADDS:
+      case INST_PRINT:
+      case INST_PUSHFRAME:
+      case INST_POPFRAME:
+      case INST_PUSHVAR:
+      case INST_RET:
+      case INST_YIELD:
+        break;
+      case INST_PUSH:
+      case INST_PUSHC:
+      case INST_ADDC:
+        inst.operand = BYTES2INT(op);
+        break;
+      case INST_PUSHA:
+      case INST_POPA:
+      case INST_DECLPOPA:
+      case INST_ADDA:
+      case INST_PRINTA:
+      case INST_ADDSPOPA:
+      case INST_ENTER:
+        inst.operand = (unsigned char)op[0];
+        break;
+      case INST_MOVA:
+      case INST_ADDAA:
+      case INST_ADDAPOPA:
+        inst.operand = (unsigned char)op[0];
+        inst.operand2 = (unsigned char)op[1];
+        break;
+      case INST_ADDAAPOPA:
+        inst.operand = (unsigned char)op[0];
+        inst.operand2 = (unsigned char)op[1];
+        inst.operand3 = (unsigned char)op[2];
+        break;
+      case INST_ADDAC:
+      case INST_SETC:
+      case INST_DECLC:
+        inst.operand = (unsigned char)op[0];
+        inst.operand2 = BYTES2INT(op + 1);
+        break;
+      case INST_ADDCPOPA:
+        inst.operand = BYTES2INT(op);
+        inst.operand2 = (unsigned char)op[4];
+        break;
+      case INST_ADDACPOPA:
+        inst.operand = (unsigned char)op[0];
+        inst.operand2 = BYTES2INT(op + 1);
+        inst.operand3 = (unsigned char)op[5];
+        break;
+      case INST_JMP:
+      {
+        int target = BYTES2INT(op);
+        if(target < 0 || target > size) target = size;
+        inst.operand = index[target];
+        break;
+      }
+      case INST_CALL:
+      {
+        int target = BYTES2INT(op);
+        if(target < 0 || target > size) target = size;
+        inst.operand = index[target];
+        inst.operand2 = (unsigned char)op[4];
+        break;
+      }
+      default: //known but not implemented by the VM
+        inst.opcode = DECODED_INVALID;
+        break;
+    }
+  }
+}
+
+int VM::getCycles()
+{
+  return cycles;
+}
+
+bool VM::isSuspended()
+{
+  return suspended;
+}
+
+const char *VM::getTrap()
+{
+  return trap.c_str();
+}
+
+int VM::getCalls()
+{
+  return calls;
+}
+
+int VM::getFrameHighWater()
+{
+  return frameHighWater;
+}
+
+//RET at the root leaves main's frame in place, so what main kept in its locals
+//can still be read, along with anything left on the operand stack
+void VM::getFinalState(vector<int> &values)
+{
+  values.clear();
+  for(int i1 = 1; i1 <= stackSize; i1++) values.push_back(stack[i1]);
+  if(currentFrame == NULL) return;
+  int count = (((FrameHeader*)currentFrame)->reserved - (int)sizeof(FrameHeader)) / 4;
+  int *locals = (int*)(currentFrame + sizeof(FrameHeader));
+  for(int i1 = 0; i1 < count; i1++) values.push_back(locals[i1]);
+}
+
+int VM::getFrameMemory()
+{
+  return frameMemory;
+}
+
+size_t VM::getMemory()
+{
+  size_t memory = sizeof(VM) + frameMemory + code.capacity() * sizeof(DecodedInstruction) + output.capacity();
+  memory += ownProgram.getSize() + ownProgram.getCode().capacity() * sizeof(DecodedInstruction) + ownProgram.getOffsets().capacity() * sizeof(int);
+  memory += ownProgram.getSize() * sizeof(int); //string lengths
+  for(size_t i1 = 0; i1 < jitCode.size(); i1++) memory += jitCode[i1].size;
+  return memory;
+}
+
+void VM::trimFrames()
+{
+  while(firstSegment->next != NULL)
+  {
+    FrameSegment *next = firstSegment->next;
+    firstSegment->next = next->next;
+    frameMemory -= next->size;
+    delete[] next->data;
+    delete next;
+  }
+  currentSegment = firstSegment;
+  currentFrame = NULL;
+  frameBytes = 0;
+}
+
+void VM::setFrameLimit(int bytes)
+{
+  frameLimit = bytes;
+}
+
+void VM::setJitThreshold(int calls)
+{
+  jitThreshold = calls;
+}
+
+void VM::setSymbols(const SymbolTable &symbols)
+{
+  this->symbols = symbols;
+}
+
+void VM::setProfileOutput(const char *path)
+{
+  profilePath = (path == NULL ? "" : path);
+}
+
+void VM::setSampleOutput(const char *path, bool lines)
+{
+  samplePath = (path == NULL ? "" : path);
+  sampleLines = lines;
+}
+
+void VM::setSampleInterval(int microseconds, int instructions)
+{
+  sampleMicros = microseconds;
+  sampleInstructions = instructions;
+}
+
+void VM::setOutput(OutputSink *sink, int bufferSize)
+{
+  flushOutput();
+  this->sink = (sink == NULL ? &stdoutSink : sink);
+  outputSize = (bufferSize < 0 ? 0 : bufferSize);
+  vector<char>().swap(output); //sized again on the next PRINT
+}
+
+void VM::flushOutput()
+{
+  if(outputUsed == 0) return;
+  int used = outputUsed;
+  outputUsed = 0;
+  sink->write(&output[0], used);
+}
+
+//Appends to the output buffer, the sink is only called when it fills up
+inline void VM::Emit(const char *data, int length)
+{
+  if(outputUsed + length > (int)output.size())
+  {
+    EmitLarge(data, length);
+    return;
+  }
+  memcpy(&output[outputUsed], data, length);
+  outputUsed += length;
+}
+
+void VM::EmitLarge(const char *data, int length)
+{
+  flushOutput();
+  if(length > outputSize) sink->write(data, length); //would not fit even in an empty buffer
+  else
+  {
+    if((int)output.size() != outputSize) output.resize(outputSize);
+    memcpy(&output[0], data, length);
+    outputUsed = length;
+  }
+}
+
+//PRINT and PRINTA take a string constant in the bytecode.  Its length was
+//measured when the program was loaded, so printing is a copy into the buffer.
+//A pointer outside the bytecode prints nothing.  RVM_PRINTF_OUTPUT builds
+//call printf for every string instead, sinks are not used.
+void VM::Print(int ptr)
+{
+#ifdef RVM_PRINTF_OUTPUT
+  printf("%s", &bytecode[ptr]);
+#else
+  if((unsigned int)ptr < (unsigned int)bytecodeSize) Emit(&bytecode[ptr], stringLengths[ptr]);
+#endif
+}
+
+void FdSink::write(const char *data, int length)
+{
+  if(fd == 1) fflush(stdout);
+  while(length > 0)
+  {
+#ifdef _WIN32
+    int written = _write(fd, data, length);
+#else
+    int written = (int)::write(fd, data, length);
+    if(written < 0 && errno == EINTR) continue;
+#endif
+    if(written <= 0) return; //lost, as printf's would be
+    data += written;
+    length -= written;
+  }
+}
+
+#ifdef RVM_SAMPLE
+//Records where the program is: the running instruction and the return
+//address saved in every frame but the root one
+void VM::TakeSample()
+{
+  Sample sample;
+  sample.depth = 0;
+  sample.truncated = false;
+  sample.offsets[sample.depth++] = program->getOffsets()[instPtr - &code[0]];
+  for(FrameHeader *frame = (FrameHeader*)currentFrame; frame != NULL && frame->prevFrame != NULL; frame = (FrameHeader*)frame->prevFrame)
+  {
+    if(sample.depth == SAMPLE_DEPTH)
+    {
+      sample.truncated = true;
+      break;
+    }
+    sample.offsets[sample.depth++] = program->getOffsets()[frame->savedPtr - &code[0]];
+  }
+  if(!sampler.push(sample)) //nobody is draining, make room
+  {
+    sampler.drain(symbols, sampleLines);
+    sampler.push(sample);
+  }
+  sampleCountdown = (sampleMicros > 0 ? INT_MAX : sampleInstructions);
 }
+#endif
 
-void VM::ExpandStack(int sz)
+//Called once a run has ended
+void VM::Finish()
 {
-  int offset = currentFrame - stackFrame;
-  ExpandIfNeeded(&stackFrame, &stackFrameSize, currentFrame - stackFrame, currentFrameSize + sz);
-  currentFrame = stackFrame + offset;
+  flushOutput();
+#ifdef RVM_SAMPLE
+  Sampler::stopTimer();
+  sampler.drain(symbols, sampleLines);
+  if(!samplePath.empty() && !sampler.write(samplePath.c_str()))
+    printf("Samples could not be written to %s\n", samplePath.c_str());
+#endif
+#ifdef RVM_PROFILE
+  profiler.finish();
+  if(!profilePath.empty() && !profiler.write(profilePath.c_str(), program->getOffsets(), symbols, cycles, frameHighWater))
+    printf("Profile could not be written to %s\n", profilePath.c_str());
+#endif
+}
+
+void VM::CompileFunction(int entry)
+{
+  JitCode jit;
+  jit.fn = JitCompile(code, entry, &jit.instructions, &jit.ret, &jit.size);
+  if(jit.fn == NULL)
+  {
+    code[entry].operand3 = -1;
+    return;
+  }
+  jitCode.push_back(jit);
+  code[entry].operand3 = (int)jitCode.size();
+}
+
+void VM::ReleaseJitCode()
+{
+  for(size_t i1 = 0; i1 < jitCode.size(); i1++) JitFree(jitCode[i1].fn, jitCode[i1].size);
+  jitCode.clear();
+}
+
+static atomic<unsigned long long> lastProgramId(0);
+
+//Bytes a frame with this many locals reserves, rounded up so the frame after
+//it starts with an aligned header
+static inline int FrameSize(int locals)
+{
+  int size = (int)sizeof(FrameHeader) + locals * 4;
+  return (size + (int)alignof(FrameHeader) - 1) & ~((int)alignof(FrameHeader) - 1);
+}
+
+void Program::load(const char *bytecode, int size)
+{
+  code.clear();
+  offsets.clear();
+  stringLengths.clear();
+  maxStack = 0;
+  id = ++lastProgramId;
+  this->bytecode.assign(bytecode, bytecode + size);
+  try
+  {
+    char *data = (this->bytecode.empty() ? NULL : &this->bytecode[0]);
+    DecodeBytecode(data, size, code, offsets);
+    VerifyProgram(data, size, code, offsets, VM::MAX_STACK, &maxStack);
+  }
+  catch(...)
+  {
+    code.clear(); //not runnable
+    throw;
+  }
+  for(size_t i1 = 0; i1 < code.size(); i1++) //every function entry now holds its local count
+  {
+    if(code[i1].opcode == INST_CALL) code[i1].operand3 = FrameSize(code[code[i1].operand].operand);
+  }
+  stringLengths.resize(size);
+  int length = 0;
+  for(int i1 = size - 1; i1 >= 0; i1--) //backwards, each length is one more than the next
+  {
+    length = (this->bytecode[i1] == 0 ? 0 : length + 1);
+    stringLengths[i1] = length;
+  }
 }
 
 void VM::execute(char *bytecode, int size)
+{
+  load(bytecode, size);
+  run();
+}
+
+void VM::execute(const Program &program)
+{
+  load(program);
+  run();
+}
+
+RunStatus VM::execute(const Program &program, int maxInstructions)
+{
+  load(program);
+  return resume(maxInstructions);
+}
+
+RunStatus VM::resume(int maxInstructions)
+{
+  trap.clear();
+  try
+  {
+    return Interpret(suspended, maxInstructions < 1 ? 1 : maxInstructions);
+  }
+  catch(exception &e)
+  {
+    trap = e.what();
+    flushOutput();
+    return RUN_TRAPPED;
+  }
+}
+
+void VM::run()
+{
+  try
+  {
+    RunStatus status = Interpret(false, INT_MAX);
+    while(status == RUN_YIELDED) status = Interpret(true, INT_MAX); //only INST_YIELD stops an unlimited run
+  }
+  catch(...)
+  {
+    flushOutput();
+    throw;
+  }
+}
+
+void VM::load(char *bytecode, int size)
+{
+  program = NULL;
+  ownProgram.load(bytecode, size);
+  load(ownProgram);
+}
+
+//The decoded code is copied because running writes to it: handlers, call
+//counts and JIT indexes are the VM's own.
+void VM::load(const Program &program)
+{
+  if(program.empty()) throw runtime_error("No program loaded");
+  if(hasLoaded(program)) return;
+  ReleaseJitCode();
+  this->program = &program;
+  programId = program.getId();
+  bytecode = program.getBytecode();
+  bytecodeSize = program.getSize();
+  stringLengths = program.getStringLengths();
+  code = program.getCode();
+  handlersResolved = false;
+  suspended = false;
+}
+
+bool VM::hasLoaded(const Program &program)
+{
+  return (programId == program.getId() && programId != 0 && !code.empty());
+}
+
+void VM::reset()
 {
   beforeJmpPtr = NULL;
-  instPtr = bytecode; //place at beginning
+  instPtr = (code.empty() ? NULL : &code[0]); //place at beginning
+  currentSegment = firstSegment; //a VM can run more than one program
+  currentFrame = NULL;
+  frameBytes = 0;
+  frameHighWater = 0;
+  stackSize = 0;
+  stack[0] = 0;
+  cycles = 0;
+  calls = 0;
+  suspended = false;
+  outputUsed = 0; //what a cancelled run printed is not the next run's
+}
+
+//Places a frame of reserved bytes after the current one, zeroes its locals
+//and makes it current.  Returns the locals.
+inline int *VM::EnterFrame(int reserved, DecodedInstruction *returnTo)
+{
+  FrameSegment *segment = currentSegment;
+  char *newLoc = (currentFrame == NULL ? segment->data : currentFrame + ((FrameHeader*)currentFrame)->reserved);
+  if(newLoc + reserved > segment->data + segment->size)
+  {
+    segment = NextSegment(reserved);
+    newLoc = segment->data;
+  }
+
+  FrameHeader *header = (FrameHeader*)newLoc;
+  header->savedPtr = returnTo;
+  header->prevFrame = currentFrame;
+  header->prevSegment = currentSegment;
+  header->reserved = reserved;
+  currentSegment = segment;
+  currentFrame = newLoc;
+
+  frameBytes += reserved;
+  if(frameBytes > frameHighWater) frameHighWater = frameBytes;
+  calls++;
+
+  int *locals = (int*)(newLoc + sizeof(FrameHeader));
+  int count = (reserved - (int)sizeof(FrameHeader)) / 4;
+  for(int i1 = 0; i1 < count; i1++) locals[i1] = 0;
+  return locals;
+}
+
+#define LOCAL(addr) (*(int*)(currentFrame + sizeof(FrameHeader) + (addr)*4))
+
+//Handlers are written once and shared by both dispatch engines.  VM_CASE opens
+//a handler, VM_NEXT ends it.  The threaded engine (GCC/Clang computed goto)
+//replicates the dispatch at the end of every handler so each one gets its own
+//indirect branch; the switch engine is the portable fallback and can be forced
+//with -DRVM_SWITCH_DISPATCH.
+//
+//Operand stack access goes through VM_PUSH/VM_POP/VM_ADD_TOP.  With
+//RVM_TOS_CACHE the top of the stack lives in a local and only the values
+//below it are in stack[], so most arithmetic touches memory once.
+//
+//load() only accepts programs VerifyProgram has proven safe, so handlers do
+//not check stack bounds, local indexes or frame space.  Build with
+//RVM_CHECKED to put the operand stack checks back.
+//
+//Budgets are only checked by JMP and CALL.  Code between them runs straight
+//through, so a run stops at most one function body's worth of instructions
+//past its budget.  A yield keeps every stack in the VM for Interpret(true).
+RunStatus VM::Interpret(bool resume, int budget)
+{
+  if(code.empty()) throw runtime_error("No program loaded");
+
+  suspended = false;
+  if(!resume)
+  {
+    reset();
+#ifdef RVM_PROFILE
+    profiler.reset(code.size());
+#endif
+#ifdef RVM_SAMPLE
+    sampler.reset();
+    sampleCountdown = (sampleMicros > 0 ? INT_MAX : sampleInstructions);
+#endif
+  }
+  long long limit = (long long)cycles + budget;
+  cycleLimit = (limit > INT_MAX ? INT_MAX : (int)limit);
+#ifdef RVM_SAMPLE
+  if(sampleMicros > 0 && !Sampler::startTimer(sampleMicros, &sampleCountdown)) sampleCountdown = INT_MAX;
+#endif
+
+#ifdef RVM_TOS_CACHE
+  int *sp = &stack[stackSize]; //spill slot for tos, stack[1..] below it
+  int tos = *sp; //stack[0] is 0 while the stack is empty
+
+#ifdef RVM_CHECKED
+#define VM_CHECK_PUSH() if(sp >= stack + MAX_STACK) throw runtime_error("Stack Overflow Exception")
+#define VM_CHECK_POP() if(sp <= stack) throw runtime_error("Stack Underflow Exception")
+#else
+#define VM_CHECK_PUSH() //VerifyProgram proved the depth stays within 0..MAX_STACK
+#define VM_CHECK_POP()
+#endif
+#define VM_PUSH(v) do { int pushed = (v); VM_CHECK_PUSH(); *sp++ = tos; tos = pushed; } while(0)
+#define VM_POP(out) do { VM_CHECK_POP(); (out) = tos; tos = *--sp; } while(0)
+#define VM_ADD_TOP(v) do { VM_CHECK_POP(); tos += (v); } while(0)
+#define VM_SYNC_STACK() do { *sp = tos; stackSize = (int)(sp - stack); } while(0)
+#define VM_CALL_NATIVE(fn, locals) do { *sp = tos; sp = (fn)((locals), sp, this); tos = *sp; } while(0)
+#define VM_STACK_DEPTH() ((int)(sp - stack))
+#else
+#define VM_PUSH(v) push(v)
+#define VM_POP(out) (out) = pop()
+#define VM_ADD_TOP(v) do { int added = (v); push(pop() + added); } while(0)
+#define VM_SYNC_STACK()
+#define VM_CALL_NATIVE(fn, locals) stackSize = (int)((fn)((locals), &stack[stackSize], this) - stack)
+#define VM_STACK_DEPTH() stackSize
+#endif
+
+#ifdef RVM_PROFILE
+#define VM_PROFILE_STEP() profiler.step(instPtr->opcode, VM_STACK_DEPTH())
+#define VM_PROFILE_ENTER(entry) profiler.enter(entry)
+#define VM_PROFILE_LEAVE() profiler.leave()
+#else
+#define VM_PROFILE_STEP() //compiled out, the interpreter is unchanged
+#define VM_PROFILE_ENTER(entry)
+#define VM_PROFILE_LEAVE()
+#endif
+
+#ifdef RVM_SAMPLE
+#define VM_SAMPLE_STEP() if(--sampleCountdown <= 0) TakeSample()
+#else
+#define VM_SAMPLE_STEP()
+#endif
+
+#ifdef RVM_SAMPLE
+#define VM_STOP_TIMER() Sampler::stopTimer()
+#else
+#define VM_STOP_TIMER()
+#endif
+
+//the instruction is given back and runs again on resume
+#define VM_CHECK_BUDGET() if(cycles > cycleLimit) { cycles--; VM_SYNC_STACK(); VM_STOP_TIMER(); suspended = true; return RUN_YIELDED; }
+
+#ifdef RVM_THREADED_DISPATCH
+  if(!handlersResolved)
+  {
+    void *dispatchTable[DECODED_OPCODES];
+    for(int i1 = 0; i1 < DECODED_OPCODES; i1++) dispatchTable[i1] = &&op_invalid;
+    dispatchTable[(unsigned char)INST_PUSH] = &&op_INST_PUSH;
+    dispatchTable[(unsigned char)INST_POP] = &&op_INST_POP;
+    dispatchTable[(unsigned char)INST_PUSHA] = &&op_INST_PUSHA;
+    dispatchTable[(unsigned char)INST_POPA] = &&op_INST_POPA;
+    dispatchTable[(unsigned char)INST_PUSHC] = &&op_INST_PUSHC;
+    dispatchTable[(unsigned char)INST_JMP] = &&op_INST_JMP;
+    dispatchTable[(unsigned char)INST_ADDS] = &&op_INST_ADDS;
+    dispatchTable[(unsigned char)INST_PRINT] = &&op_INST_PRINT;
+    dispatchTable[(unsigned char)INST_PUSHFRAME] = &&op_INST_PUSHFRAME;
+    dispatchTable[(unsigned char)INST_POPFRAME] = &&op_INST_POPFRAME;
+    dispatchTable[(unsigned char)INST_CALL] = &&op_INST_CALL;
+    dispatchTable[(unsigned char)INST_RET] = &&op_INST_RET;
+    dispatchTable[(unsigned char)INST_ENTER] = &&op_INST_ENTER;
+    dispatchTable[(unsigned char)INST_YIELD] = &&op_INST_YIELD;
+    dispatchTable[(unsigned char)INST_PUSHVAR] = &&op_INST_PUSHVAR;
+    dispatchTable[(unsigned char)INST_DECLPOPA] = &&op_INST_DECLPOPA;
+    dispatchTable[(unsigned char)INST_MOVA] = &&op_INST_MOVA;
+    dispatchTable[(unsigned char)INST_ADDA] = &&op_INST_ADDA;
+    dispatchTable[(unsigned char)INST_ADDC] = &&op_INST_ADDC;
+    dispatchTable[(unsigned char)INST_ADDAA] = &&op_INST_ADDAA;
+    dispatchTable[(unsigned char)INST_ADDAC] = &&op_INST_ADDAC;
+    dispatchTable[(unsigned char)INST_ADDAAPOPA] = &&op_INST_ADDAAPOPA;
+    dispatchTable[(unsigned char)INST_ADDACPOPA] = &&op_INST_ADDACPOPA;
+    dispatchTable[(unsigned char)INST_PRINTA] = &&op_INST_PRINTA;
+    dispatchTable[(unsigned char)INST_SETC] = &&op_INST_SETC;
+    dispatchTable[(unsigned char)INST_ADDAPOPA] = &&op_INST_ADDAPOPA;
+    dispatchTable[(unsigned char)INST_ADDCPOPA] = &&op_INST_ADDCPOPA;
+    dispatchTable[(unsigned char)INST_DECLC] = &&op_INST_DECLC;
+    dispatchTable[(unsigned char)INST_ADDSPOPA] = &&op_INST_ADDSPOPA;
+    dispatchTable[DECODED_HALT] = &&op_DECODED_HALT;
+
+    for(size_t i1 = 0; i1 < code.size(); i1++) code[i1].handler = dispatchTable[code[i1].opcode];
+    handlersResolved = true;
+  }
+
+#define VM_CASE(inst) op_##inst:
+#define VM_DEFAULT op_invalid:
+#define VM_NEXT() do { cycles++; VM_PROFILE_STEP(); VM_SAMPLE_STEP(); goto *instPtr->handler; } while(0)
 
-  int cycles = 0;
+  VM_NEXT();
+#else
+#define VM_CASE(inst) case inst:
+#define VM_DEFAULT default:
+#define VM_NEXT() break
 
-  while(instPtr >= bytecode && instPtr < bytecode + size)
+  for(;;)
   {
     cycles++;
-    char instruction = *instPtr;
-    switch(instruction)
+    VM_PROFILE_STEP();
+    VM_SAMPLE_STEP();
+    switch(instPtr->opcode)
     {
-      case INST_PUSH:
+#endif
+      VM_CASE(INST_PUSH)
       {
-        int value = BYTES2INT(instPtr + 1);
-        instPtr +=5;
-        push(value);
-        break;
+        VM_PUSH(instPtr->operand);
+        instPtr++;
+        VM_NEXT();
       }
-      case INST_POP:
+      VM_CASE(INST_POP)
       {
-        pop();
+        int junk;
+        VM_POP(junk);
+        (void)junk;
         instPtr++;
-        break;
+        VM_NEXT();
       }
-      case INST_PUSHA: //on stack
+      VM_CASE(INST_PUSHA) //on stack
       {
-        int addr = (int)*((unsigned char*)(instPtr+1)); //actually a unsigned char
-        int value = BYTES2INT(currentFrame+sizeof(FrameHeader)+(addr*4));
-        instPtr += 2;
-        push(value);
-        break;
+        VM_PUSH(LOCAL(instPtr->operand));
+        instPtr++;
+        VM_NEXT();
       }
-      case INST_POPA: //on stack
+      VM_CASE(INST_POPA) //on stack
       {
-        int addr = (int)*((unsigned char*)(instPtr+1)); //actually a unsigned char
-        int value = pop();
-        instPtr += 2;
-        INT2BYTES(value, (&currentFrame[sizeof(FrameHeader)+(addr*4)]));
-        break;
+        VM_POP(LOCAL(instPtr->operand));
+        instPtr++;
+        VM_NEXT();
       }
-      case INST_PUSHC:
+      VM_CASE(INST_PUSHC)
       {
-        int addr = BYTES2INT(instPtr+1);
-        push(addr);
-        instPtr += 5;
-        break;
+        VM_PUSH(instPtr->operand);
+        instPtr++;
+        VM_NEXT();
       }
-      case INST_JMP:
+      VM_CASE(INST_JMP)
       {
-        int addr = BYTES2INT(instPtr + 1);
-        beforeJmpPtr = instPtr + 5;
-        instPtr = &bytecode[addr];
-        break;
+        VM_CHECK_BUDGET();
+        beforeJmpPtr = instPtr + 1;
+        instPtr = &code[instPtr->operand];
+        VM_NEXT();
       }
-      case INST_ADDS:
+      VM_CASE(INST_ADDS)
       {
-        push(pop() + pop());
+        int value;
+        VM_POP(value);
+        VM_ADD_TOP(value);
         instPtr++;
-        break;
+        VM_NEXT();
       }
-      case INST_PRINT:
+      VM_CASE(INST_PRINT)
       {
-        int ptr = pop();
-        const char *data = &bytecode[ptr];
-        printf("%s", data);
+        int ptr;
+        VM_POP(ptr);
+        Print(ptr);
         instPtr++;
-        break;
+        VM_NEXT();
       }
-      case INST_PUSHFRAME:
+      VM_CASE(INST_PUSHFRAME)
+      VM_CASE(INST_ENTER)
       {
-        ExpandStack((int)sizeof(FrameHeader));
-        FrameHeader newFrame;
-        newFrame.savedPtr = beforeJmpPtr;
-        newFrame.savedSize = currentFrameSize;
-        newFrame.prevFrame = currentFrame;
-        char *newLoc = currentFrame + currentFrameSize;
-        memcpy(newLoc, &newFrame, sizeof(FrameHeader));
-        currentFrame = newLoc;
-        currentFrameSize = (int)sizeof(FrameHeader);
+        EnterFrame(FrameSize(instPtr->operand), beforeJmpPtr); //all locals, counted by the verifier
+        VM_PROFILE_ENTER((int)(instPtr - &code[0]));
         instPtr++;
-        break;
+        VM_NEXT();
       }
-      case INST_POPFRAME:
+      VM_CASE(INST_CALL) //does the frame setup of the callee's PUSHFRAME or ENTER, so it is skipped
+      {
+        VM_CHECK_BUDGET();
+        int *locals = EnterFrame(instPtr->operand3, instPtr + 1);
+        for(int i1 = instPtr->operand2 - 1; i1 >= 0; i1--) VM_POP(locals[i1]);
+        VM_PROFILE_ENTER(instPtr->operand);
+#ifdef RVM_JIT
+        DecodedInstruction *entry = &code[instPtr->operand];
+        if(entry->operand3 == 0 && jitThreshold >= 0 && ++entry->operand2 > jitThreshold) CompileFunction(instPtr->operand);
+        if(entry->operand3 > 0)
+        {
+          JitCode &jit = jitCode[entry->operand3 - 1];
+          VM_CALL_NATIVE(jit.fn, locals);
+          cycles += jit.instructions;
+          instPtr = &code[jit.ret]; //the interpreter leaves the frame
+          VM_NEXT();
+        }
+#endif
+        instPtr = &code[instPtr->operand + 1];
+        VM_NEXT();
+      }
+      VM_CASE(INST_POPFRAME)
+      VM_CASE(INST_RET) //a return value is already on top of the operand stack
       {
-        if(currentFrame == stackFrame)
+        FrameHeader *header = (FrameHeader*)currentFrame;
+        if(header == NULL || header->prevFrame == NULL)
         {
           //end execution
-          printf("\nExecution completed in %d cycles\n", cycles);
-          return;
+          VM_SYNC_STACK();
+          Finish();
+          return RUN_COMPLETED;
         }
 
-        FrameHeader *header = (FrameHeader*)currentFrame;
+        VM_PROFILE_LEAVE();
+        frameBytes -= header->reserved;
         instPtr = header->savedPtr;
         currentFrame = header->prevFrame;
-        currentFrameSize = header->savedSize;
-        break;
+        currentSegment = header->prevSegment;
+        VM_NEXT();
       }
-      case INST_PUSHVAR:
+      VM_CASE(INST_YIELD) //run() carries straight on
       {
-        ExpandStack(4);
-        *(int*)(&currentFrame[currentFrameSize]) = 0; //zeros out variables to be nice
-        currentFrameSize += 4;
         instPtr++;
-        break;
+        VM_SYNC_STACK();
+        VM_STOP_TIMER();
+        suspended = true;
+        return RUN_YIELDED;
+      }
+      VM_CASE(INST_PUSHVAR) //the whole frame was reserved and zeroed on entry
+      {
+        instPtr++;
+        VM_NEXT();
+      }
+      VM_CASE(INST_DECLPOPA)
+      {
+        VM_POP(LOCAL(instPtr->operand));
+        instPtr++;
+        VM_NEXT();
+      }
+      VM_CASE(INST_MOVA)
+      {
+        LOCAL(instPtr->operand2) = LOCAL(instPtr->operand);
+        instPtr++;
+        VM_NEXT();
+      }
+      VM_CASE(INST_ADDA)
+      {
+        VM_ADD_TOP(LOCAL(instPtr->operand));
+        instPtr++;
+        VM_NEXT();
+      }
+      VM_CASE(INST_ADDC)
+      {
+        VM_ADD_TOP(instPtr->operand);
+        instPtr++;
+        VM_NEXT();
+      }
+      VM_CASE(INST_ADDAA)
+      {
+        VM_PUSH(LOCAL(instPtr->operand) + LOCAL(instPtr->operand2));
+        instPtr++;
+        VM_NEXT();
+      }
+      VM_CASE(INST_ADDAC)
+      {
+        VM_PUSH(LOCAL(instPtr->operand) + instPtr->operand2);
+        instPtr++;
+        VM_NEXT();
+      }
+      VM_CASE(INST_ADDAAPOPA)
+      {
+        LOCAL(instPtr->operand3) = LOCAL(instPtr->operand) + LOCAL(instPtr->operand2);
+        instPtr++;
+        VM_NEXT();
+      }
+      VM_CASE(INST_ADDACPOPA)
+      {
+        LOCAL(instPtr->operand3) = LOCAL(instPtr->operand) + instPtr->operand2;
+        instPtr++;
+        VM_NEXT();
+      }
+      VM_CASE(INST_PRINTA)
+      {
+        Print(LOCAL(instPtr->operand));
+        instPtr++;
+        VM_NEXT();
       }
-      default:
+      VM_CASE(INST_SETC)
+      {
+        LOCAL(instPtr->operand) = instPtr->operand2;
+        instPtr++;
+        VM_NEXT();
+      }
+      VM_CASE(INST_ADDAPOPA)
+      {
+        int value;
+        VM_POP(value);
+        LOCAL(instPtr->operand2) = value + LOCAL(instPtr->operand);
+        instPtr++;
+        VM_NEXT();
+      }
+      VM_CASE(INST_ADDCPOPA)
+      {
+        int value;
+        VM_POP(value);
+        LOCAL(instPtr->operand2) = value + instPtr->operand;
+        instPtr++;
+        VM_NEXT();
+      }
+      VM_CASE(INST_DECLC)
+      {
+        LOCAL(instPtr->operand) = instPtr->operand2;
+        instPtr++;
+        VM_NEXT();
+      }
+      VM_CASE(INST_ADDSPOPA)
+      {
+        int value;
+        VM_POP(value);
+        VM_ADD_TOP(value);
+        VM_POP(LOCAL(instPtr->operand));
+        instPtr++;
+        VM_NEXT();
+      }
+      VM_CASE(DECODED_HALT)
+      {
+        cycles--; //not a real instruction
+        VM_SYNC_STACK();
+        Finish();
+        return RUN_COMPLETED;
+      }
+      VM_DEFAULT
       {
         throw runtime_error("Invalid Instruction");
-        break;
       }
+#ifndef RVM_THREADED_DISPATCH
     }
-
   }
+#endif
+
+#undef VM_CASE
+#undef VM_DEFAULT
+#undef VM_NEXT
+#undef VM_PUSH
+#undef VM_POP
+#undef VM_ADD_TOP
+#undef VM_SYNC_STACK
+#undef VM_CHECK_PUSH
+#undef VM_CHECK_POP
+#undef VM_CHECK_BUDGET
+#undef VM_STOP_TIMER
 }
 
+#undef LOCAL
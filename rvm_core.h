@@ -3,68 +3,40 @@
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 #include <map>
+#include <vector>
+#include <deque>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <signal.h>
+#include <limits.h>
 
 typedef struct _Symbol
 {
   char name[32];
   unsigned int address;
+  unsigned int end; //first offset past the function
 } Symbol;
 
-struct cmpStr
+typedef struct _LineEntry
 {
-  bool operator()(const char *a, const char *b) const
-  {
-    return strcmp(a, b) < 0;
-  }
-};
-
-extern std::map<const char*, char, cmpStr> *instructionList;
+  unsigned int address; //first instruction of a statement
+  int line;
+  int column;
+} LineEntry;
 
-class InstructionAdder
+typedef struct _SymbolTable
 {
-public:
-  InstructionAdder(const char *name, char value)
-  {
-    if(instructionList == NULL) instructionList = new std::map<const char*, char, cmpStr>();
-    (*instructionList)[name] = value;
-  }
-  ~InstructionAdder()
-  {
-    if(instructionList != NULL)
-    {
-      delete instructionList;
-      instructionList = NULL;
-    }
-  }
-};
+  std::vector<Symbol> functions;
+  std::vector<LineEntry> lines; //ordered by address
+} SymbolTable;
 
-#define INSTRUCTION(name,value) const char name = value; const InstructionAdder name##_lister(#name, value);
-
-//BEGIN INSTRUCTIONS
-
-INSTRUCTION(INST_NOP        , 0x04)
-INSTRUCTION(INST_ADDS       , 0x05)
-INSTRUCTION(INST_SUBS       , 0x06)
-INSTRUCTION(INST_MULTS      , 0x07)
-INSTRUCTION(INST_DIVS       , 0x08)
-INSTRUCTION(INST_ADDSF      , 0x09)
-INSTRUCTION(INST_SUBSF      , 0x0A)
-INSTRUCTION(INST_MULTSF     , 0x0B)
-INSTRUCTION(INST_DIVSF      , 0x0C)
-INSTRUCTION(INST_PRINT      , 0x10)
-INSTRUCTION(INST_JMP        , 0x11)
-INSTRUCTION(INST_PUSH       , 0x12) //push raw value
-INSTRUCTION(INST_POP        , 0x13)
-INSTRUCTION(INST_PUSHFRAME  , 0x14) //push stack frame
-INSTRUCTION(INST_POPFRAME   , 0x15)
-INSTRUCTION(INST_PUSHA      , 0x16) //push from an address
-INSTRUCTION(INST_POPA       , 0x17) //pop into an address
-INSTRUCTION(INST_PUSHC      , 0x18) //global constants
-INSTRUCTION(INST_PUSHVAR    , 0x19) //puts a variable on the stack frame
-INSTRUCTION(INST_CONCATSTRINGSTRING, 0x1A);
-
-//END INST
+#define INSTRUCTION(name,value) const char name = value;
+#include "rvm_instructions.h"
+#undef INSTRUCTION
 
 //enum INST
 //{
@@ -89,17 +61,20 @@ INSTRUCTION(INST_CONCATSTRINGSTRING, 0x1A);
 //};
 
 extern int ExpandBytes(char **ptr, int currentLength);
-extern char GetInstructionByName(const char *inst);
+extern int InstructionLength(char inst);
+extern char GetInstructionByName(const char *inst); //0 if there is no such instruction
+extern const char *GetInstructionName(int inst);
 extern char ProcessEscape(const char *str, int *len);
 
 static inline int BYTES2INT(char *c)
 {
-  int a = 0;
-  a = (a << 8) + c[0];
-  a = (a << 8) + c[1];
-  a = (a << 8) + c[2];
-  a = (a << 8) + c[3];
-  return a;
+  unsigned char *u = (unsigned char*)c; //plain char is signed on most targets
+  unsigned int a = 0;
+  a = (a << 8) + u[0];
+  a = (a << 8) + u[1];
+  a = (a << 8) + u[2];
+  a = (a << 8) + u[3];
+  return (int)a;
 }
 
 static inline void INT2BYTES(int i, char *c)
@@ -110,53 +85,497 @@ static inline void INT2BYTES(int i, char *c)
   c[3] = i & 0xff;
 }
 
+//Dispatch engine for VM::execute.  Computed goto is used when the compiler
+//supports it; define RVM_SWITCH_DISPATCH to build the portable switch loop.
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(RVM_SWITCH_DISPATCH)
+#define RVM_THREADED_DISPATCH
+#endif
+
+//Keep the top of the operand stack in a register while running.  Define
+//RVM_NO_TOS_CACHE to go through VM::push/VM::pop for every access.
+#ifndef RVM_NO_TOS_CACHE
+#define RVM_TOS_CACHE
+#endif
+
+//Pseudo opcodes produced by DecodeBytecode.  They never appear in a .rexe.
+#define DECODED_HALT    0x100 //fell off the end of the bytecode or jumped outside it
+#define DECODED_INVALID 0x101 //unknown opcode or truncated operand, traps when reached
+#define DECODED_OPCODES 0x102
+
+//Fixed width, native endian form of one bytecode instruction.  Jump operands
+//are indexes into the decoded stream, so nothing is decoded while running.
+typedef struct _DecodedInstruction
+{
+  const void *handler; //threaded dispatch target, resolved on first run
+  int opcode;
+  int operand;
+  int operand2; //superinstructions and CALL
+  int operand3; //for CALL, bytes to reserve for the callee's frame
+} DecodedInstruction;
+
+extern void DecodeBytecode(char *bytecode, int size, std::vector<DecodedInstruction> &out, std::vector<int> &offsets);
+extern void VerifyProgram(char *bytecode, int size, std::vector<DecodedInstruction> &code, const std::vector<int> &offsets, int stackLimit, int *maxStack);
+
+//Baseline JIT (rvm_jit.cpp) for functions without calls, built on Linux
+//x86-64 unless RVM_NO_JIT is defined.  A function is compiled once it has been
+//called more than the VM's threshold, everything else stays interpreted.
+#if defined(__x86_64__) && defined(__linux__) && !defined(RVM_NO_JIT) && !defined(RVM_PROFILE) && !defined(RVM_SAMPLE)
+#define RVM_JIT
+#endif
+#define RVM_JIT_THRESHOLD 1000
+
+class VM;
+typedef int *(*JitFunction)(int *locals, int *sp, VM *vm); //returns the new sp
+
+typedef struct _JitCode
+{
+  JitFunction fn;
+  size_t size;
+  int instructions; //interpreted instructions the call replaces, for the cycle count
+  int ret; //index of the function's RET, executed after fn
+} JitCode;
+
+extern JitFunction JitCompile(const std::vector<DecodedInstruction> &code, int entry, int *instructions, int *ret, size_t *size);
+extern void JitFree(JitFunction fn, size_t size);
+
+//Function ranges and statement positions written by the compiler next to a
+//.rexe (rvm_symbols.cpp)
+extern bool SaveSymbols(const char *path, const SymbolTable &symbols);
+extern bool LoadSymbols(const char *path, SymbolTable &symbols);
+extern const Symbol *FindFunction(const SymbolTable &symbols, int offset); //function containing offset, or NULL
+extern const LineEntry *FindLine(const SymbolTable &symbols, int offset); //statement containing offset, or NULL
+
+//Counting profiler (rvm_profile.cpp), built into VM::run when RVM_PROFILE is
+//defined.  The JIT is left out of profiling builds so every instruction is
+//counted.
+typedef struct _ProfileFunction
+{
+  long long calls;
+  long long inclusiveNs;
+  long long exclusiveNs;
+  int running; //activations currently on the call stack
+} ProfileFunction;
+
+typedef struct _ProfileActivation
+{
+  int entry;
+  long long start;
+  long long childNs; //inclusive time of the functions it called
+} ProfileActivation;
+
+class Profiler
+{
+public:
+  void reset(size_t codeSize);
+  inline void step(int opcode, int stackDepth)
+  {
+    opcodeCounts[opcode]++;
+    if(stackDepth > maxStackDepth) maxStackDepth = stackDepth;
+  }
+  void enter(int entry);
+  void leave();
+  void finish(); //leaves every function still running
+  bool write(const char *path, const std::vector<int> &offsets,
+             const SymbolTable &symbols, int cycles, int frameHighWater);
+
+private:
+  long long opcodeCounts[DECODED_OPCODES];
+  std::vector<ProfileFunction> functions; //indexed like the decoded code, by entry
+  std::vector<ProfileActivation> active;
+  int maxStackDepth;
+  int maxFrameDepth;
+};
+
+//Sampling profiler (rvm_sample.cpp), built into VM::run when RVM_SAMPLE is
+//defined.  SIGPROF, or a count of instructions, asks the interpreter for a
+//sample, which it takes at the next instruction boundary by walking the frame
+//chain.  Samples pass through a single producer, single consumer ring, so a
+//second thread can drain it while the program runs.  Like RVM_PROFILE this
+//leaves the JIT out.
+#define SAMPLE_DEPTH 32
+#define SAMPLE_RING_SIZE 4096 //power of two
+
+typedef struct _Sample
+{
+  int depth;
+  bool truncated; //deeper than SAMPLE_DEPTH, the outermost frames were dropped
+  int offsets[SAMPLE_DEPTH]; //bytecode offsets, the running instruction first, then return addresses
+} Sample;
+
+class Sampler
+{
+public:
+  Sampler() : head(0), tail(0) {}
+  void reset();
+  bool push(const Sample &sample); //producer, false when the ring is full
+  bool pop(Sample &sample); //consumer
+  void drain(const SymbolTable &symbols, bool lines); //turns queued samples into stack counts
+  bool write(const char *path); //collapsed stacks, "outer;inner count" per line
+  static bool startTimer(int microseconds, volatile sig_atomic_t *flag); //SIGPROF zeroes *flag
+  static void stopTimer();
+
+private:
+  std::vector<Sample> ring;
+  std::atomic<unsigned int> head;
+  std::atomic<unsigned int> tail;
+  std::map<std::string, long long> stacks;
+};
+
+//Bytecode that has been decoded and verified, read only once loaded.  VMs
+//only ever read it, so one Program can be shared by any number of VMs, on any
+//number of threads, for as long as it outlives them.
+class Program
+{
+public:
+  Program() : maxStack(0), id(0) {}
+
+  void load(const char *bytecode, int size); //copies bytecode, throws runtime_error if it does not verify
+  bool empty() const { return code.empty(); }
+  const char *getBytecode() const { return (bytecode.empty() ? NULL : &bytecode[0]); }
+  int getSize() const { return (int)bytecode.size(); }
+  const std::vector<DecodedInstruction> &getCode() const { return code; }
+  const std::vector<int> &getOffsets() const { return offsets; }
+  int getMaxStack() const { return maxStack; } //deepest the operand stack gets
+  const int *getStringLengths() const { return (stringLengths.empty() ? NULL : &stringLengths[0]); } //one per bytecode byte
+  unsigned long long getId() const { return id; } //different for every load in the process
+
+private:
+  Program(const Program&);
+  Program& operator=(const Program&);
+
+  std::vector<char> bytecode; //kept for string constants
+  std::vector<DecodedInstruction> code; //handlers unresolved, CALL operand3 holds the callee's frame bytes
+  std::vector<int> offsets; //bytecode offset of each decoded instruction
+  std::vector<int> stringLengths; //bytes from each offset to the next '\0' or the end, so PRINT knows a constant's length
+  int maxStack;
+  unsigned long long id;
+};
+
+//How VM::execute(program, maxInstructions) and VM::resume ended
+enum RunStatus
+{
+  RUN_COMPLETED = 0,
+  RUN_YIELDED, //used up its budget, resume carries on where it stopped
+  RUN_TRAPPED, //threw, getTrap has the message
+};
+
+//Where a VM's PRINT output goes.  The VM collects output in a buffer of its
+//own and hands it over in large pieces, so a sink sees few writes.  write must
+//not throw.
+class OutputSink
+{
+public:
+  virtual ~OutputSink() {}
+  virtual void write(const char *data, int length) = 0;
+};
+
+//A file descriptor, written with one write(2) per piece.  For fd 1, stdio's
+//stdout is flushed first so text the host printed comes out in order.
+class FdSink : public OutputSink
+{
+public:
+  FdSink(int fd = 1) : fd(fd) {}
+  void write(const char *data, int length);
+
+private:
+  int fd;
+};
+
+//Keeps everything written, for hosts that want the text
+class MemorySink : public OutputSink
+{
+public:
+  void write(const char *data, int length) { text.append(data, length); }
+  const std::string &getText() const { return text; }
+  void clear() { text.clear(); }
+
+private:
+  std::string text;
+};
+
+typedef void (*OutputCallback)(const char *data, int length, void *user);
+
+//Hands every piece to a function of the host's
+class CallbackSink : public OutputSink
+{
+public:
+  CallbackSink(OutputCallback fn, void *user) : fn(fn), user(user) {}
+  void write(const char *data, int length) { fn(data, length, user); }
+
+private:
+  OutputCallback fn;
+  void *user;
+};
+
+#define OUTPUT_BUFFER_SIZE 4096
+
+//Frames live in a chain of fixed size segments that are never moved or
+//freed while the VM lives, so frame links can be plain pointers.  A frame
+//that does not fit in the rest of the current segment starts the next one.
+typedef struct _FrameSegment
+{
+  struct _FrameSegment *next;
+  int size;
+  char *data;
+} FrameSegment;
+
 typedef struct _FrameHeader
 {
-  char *savedPtr;
-  int savedSize;
-  char *prevFrame;
+  DecodedInstruction *savedPtr;
+  char *prevFrame; //NULL for the root frame
+  FrameSegment *prevSegment;
+  int reserved; //bytes reserved for this frame, header included, the next frame starts after them
 } FrameHeader;
 
 class VM
 {
 public:
-#define INITIAL_FRAME_SIZE 128
+#define FRAME_SEGMENT_SIZE 16384
+#define FRAME_LIMIT (64 << 20) //default cap on frame segment bytes, deep recursion traps instead of exhausting memory
+  static const int MAX_STACK = 128;
 
-  VM() : stackSize(0)
+  //Later segments are at least FRAME_SEGMENT_SIZE, a small first one keeps
+  //VMs that run shallow scripts small
+  VM(int firstSegmentSize = FRAME_SEGMENT_SIZE) : stackSize(0), program(NULL), programId(0), bytecode(NULL), bytecodeSize(0),
+         stringLengths(NULL), handlersResolved(false), jitThreshold(RVM_JIT_THRESHOLD), sampleLines(false), sampleMicros(1000),
+         sampleInstructions(0), sink(&stdoutSink), outputSize(OUTPUT_BUFFER_SIZE), outputUsed(0), cycles(0), cycleLimit(INT_MAX),
+         calls(0), suspended(false)
   {
-    stackFrame = new char[INITIAL_FRAME_SIZE];
-    stackFrameSize = INITIAL_FRAME_SIZE;
-    currentFrame = stackFrame;
-    currentFrameSize = 0;
+    frameMemory = 0;
+    frameLimit = FRAME_LIMIT;
+    firstSegment = NewSegment(firstSegmentSize);
+    currentSegment = firstSegment;
+    currentFrame = NULL;
+    frameBytes = 0;
+    frameHighWater = 0;
   }
 
   ~VM()
   {
-    delete[] stackFrame;
+    if(sink == &stdoutSink) flushOutput(); //a host's sink may already be gone
+#ifdef RVM_SAMPLE
+    Sampler::stopTimer();
+#endif
+    ReleaseJitCode();
+    while(firstSegment != NULL)
+    {
+      FrameSegment *next = firstSegment->next;
+      delete[] firstSegment->data;
+      delete firstSegment;
+      firstSegment = next;
+    }
   }
 
   void push(int value);
   int pop();
 
-  void execute(char *bytecode, int size);
+  void execute(char *bytecode, int size); //load followed by run
+  void execute(const Program &program);
+  RunStatus execute(const Program &program, int maxInstructions); //resumes if the VM yielded in program
+  RunStatus resume(int maxInstructions); //carries on a yielded run, or starts a new one
+  bool isSuspended(); //yielded and not reset or loaded with another program since
+  const char *getTrap(); //message of the last RUN_TRAPPED
+  void load(char *bytecode, int size); //decodes and verifies into a Program of the VM's own
+  void load(const Program &program); //shared, must outlive the VM's use of it
+  bool hasLoaded(const Program &program); //loading it again keeps the decoded code and compiled functions
+  void run();
+  void reset(); //empties the stacks and counters, ends a suspended run and drops its unflushed output, memory is kept
+  int getCycles(); //instructions dispatched by the last run, every slice of it
+  int getCalls(); //frames entered by the last run
+  int getFrameHighWater(); //most frame bytes live at once during the last run
+  void getFinalState(std::vector<int> &values); //after a completed run, the operand stack bottom first, then the last frame's locals
+  int getFrameMemory(); //bytes held in frame segments
+  size_t getMemory(); //bytes held by the VM, frames, decoded code and compiled functions included
+  void trimFrames(); //frees every frame segment but the first, not while running
+  void setFrameLimit(int bytes); //most bytes frame segments may hold, a call that needs more throws
+  void setJitThreshold(int calls); //calls before a function is compiled, negative turns the JIT off
+  void setSymbols(const SymbolTable &symbols); //names functions in profiles
+  void setProfileOutput(const char *path); //JSON written after each run of a RVM_PROFILE build
+  void setSampleOutput(const char *path, bool lines); //collapsed stacks written after each run of a RVM_SAMPLE build
+  void setSampleInterval(int microseconds, int instructions); //CPU time between samples, or instructions when microseconds is 0
+  //NULL for stdout, a buffer size of 0 hands each PRINT over as it runs.  The
+  //sink is the host's and must stay alive until setOutput(NULL) detaches it,
+  //which flushes into it first.  A VM destroyed with a host's sink attached
+  //drops whatever output it still buffers.
+  void setOutput(OutputSink *sink, int bufferSize = OUTPUT_BUFFER_SIZE);
+  void flushOutput(); //hands buffered output to the sink, done whenever a run completes or traps
 
 private:
-  static const int MAX_STACK = 128;
-
   int stackSize;
-  int stack[MAX_STACK];
+  int stack[MAX_STACK + 1]; //values live in stack[1..stackSize], stack[0] is scratch
+
+  FrameSegment *firstSegment;
+  FrameSegment *currentSegment; //segment holding currentFrame
+  char *currentFrame; //NULL at the top level
+  int frameBytes;
+  int frameHighWater;
+  int frameMemory;
+  int frameLimit;
+
+  Program ownProgram; //for load(bytecode, size)
+  const Program *program; //being run, never written
+  unsigned long long programId; //a Program can be reloaded, or freed and another created in its place
+  const char *bytecode; //program's, for string constants
+  int bytecodeSize;
+  const int *stringLengths; //program's
+  std::vector<DecodedInstruction> code; //copy of program's, function entries count calls in operand2 and hold jitCode index + 1 in operand3, -1 if not compilable
+  bool handlersResolved;
+  std::vector<JitCode> jitCode;
+  int jitThreshold;
+  SymbolTable symbols;
+  std::string profilePath;
+  std::string samplePath;
+  bool sampleLines;
+  int sampleMicros;
+  int sampleInstructions;
+  FdSink stdoutSink;
+  OutputSink *sink;
+  std::vector<char> output; //PRINT text the sink has not been given, sized on first use
+  int outputSize;
+  int outputUsed;
+#ifdef RVM_PROFILE
+  Profiler profiler;
+#endif
+#ifdef RVM_SAMPLE
+  Sampler sampler;
+  volatile sig_atomic_t sampleCountdown; //instructions until the next sample
+  void TakeSample();
+#endif
+
+  DecodedInstruction *instPtr;
+  DecodedInstruction *beforeJmpPtr;
+
+  int cycles;
+  int cycleLimit; //JMP and CALL yield once cycles goes past it
+  int calls;
+  bool suspended;
+  std::string trap;
+
+  RunStatus Interpret(bool resume, int budget);
+  FrameSegment *NewSegment(int size);
+  FrameSegment *NextSegment(int size);
+  int *EnterFrame(int reserved, DecodedInstruction *returnTo);
+  void CompileFunction(int entry);
+  void ReleaseJitCode();
+  void Finish();
+  void Print(int ptr);
+  void Emit(const char *data, int length);
+  void EmitLarge(const char *data, int length);
+  friend void JitPrint(VM *vm, int ptr);
+};
 
-  char *stackFrame;
-  int stackFrameSize;
-  char *currentFrame;
-  int currentFrameSize;
 
-  char *instPtr;
-  char *beforeJmpPtr;
+typedef struct _VMPoolStats
+{
+  long long acquires;
+  long long hits; //acquires given an idle VM
+  long long programHits; //hits on a VM that had the program loaded already
+  long long misses; //acquires that constructed a VM
+  long long discarded; //releases deleted for going over the retain limit
+  int idle; //VMs waiting in the pool
+  int frameHighWater; //most frame bytes any released VM's last run had live at once
+  size_t retainedBytes; //held by the idle VMs
+} VMPoolStats;
+
+//Keeps released VMs, with their frame segments and compiled functions, for
+//the next acquire (rvm_pool.cpp).  Safe to use from any thread.  A VM that
+//would take the idle VMs past retainLimit bytes is trimmed to one frame
+//segment, and deleted if that is not enough.  Settings made on a VM stay with
+//it.  Every VM must be released before the pool is destroyed.
+class VMPool
+{
+public:
+  VMPool(size_t retainLimit = 64 * 1024 * 1024);
+  ~VMPool();
+  VM *acquire(); //for VM::load(bytecode, size) or execute
+  VM *acquire(const Program &program); //loaded, preferring a VM that already had it
+  void release(VM *vm);
+  void setRetainLimit(size_t bytes); //applies to later releases
+  VMPoolStats getStats();
 
-  void ExpandStack(int sz);
+private:
+  VMPool(const VMPool&);
+  VMPool& operator=(const VMPool&);
+
+  VM *take(const Program *program); //NULL on a miss
+
+  std::mutex lock;
+  std::vector<VM*> idle; //most recently released last
+  size_t retainLimit;
+  VMPoolStats stats;
 };
 
+//A script run by a FiberScheduler.  Its VM holds its operand stack and
+//frames between slices.
+typedef struct _Fiber
+{
+  const Program *program;
+  VM *vm; //from its first slice to its last
+  RunStatus status; //RUN_YIELDED until it has ended
+  int cycles; //instructions it dispatched, once ended
+  int slices;
+  std::string trap; //message if it trapped
+} Fiber;
+
+typedef struct _FiberWorkerStats
+{
+  long long slices;
+  long long steals; //fibers taken from another worker's queue
+  long long instructions;
+  int ended; //fibers whose last slice ran here
+} FiberWorkerStats;
+
+#define FIBER_SEGMENT_SIZE 1024 //first frame segment of a fiber's VM
+#define FIBER_SPARE_VMS 8 //VMs of ended fibers a worker keeps, trimmed to their first segment
+
+//Runs many fibers over a fixed set of worker threads (rvm_fiber.cpp).  Every
+//worker has a queue of its own.  It runs the fiber at the front for one
+//slice, and puts it back at the end if it yielded.  When its queue is empty
+//it steals from the end of another worker's, and when every queue is empty it
+//sleeps until a fiber is queued or the run ends.  A slice ends when its
+//instruction budget is used up or at INST_YIELD.  Up to FIBER_SPARE_VMS VMs
+//of ended fibers are kept by their worker for the next fibers it starts.
+class FiberScheduler
+{
+public:
+  FiberScheduler(int workers = 0, int slice = 10000); //0 workers is one per core
+  ~FiberScheduler();
+  int spawn(const Program &program); //not while running, returns the fiber's index
+  void run(); //returns once every fiber has ended
+  void clear(); //forgets every fiber, they must have ended
+  int getWorkerCount();
+  int getFiberCount();
+  const Fiber &getFiber(int index);
+  FiberWorkerStats getWorkerStats(int worker); //of the last run
+  void setFrameLimit(int bytes); //VM::setFrameLimit of every fiber, not while running
+
+private:
+  FiberScheduler(const FiberScheduler&);
+  FiberScheduler& operator=(const FiberScheduler&);
+
+  typedef struct _Worker
+  {
+    std::mutex lock;
+    std::deque<Fiber*> queue;
+    std::vector<VM*> spare; //only touched by the worker's own thread
+    FiberWorkerStats stats;
+  } Worker;
+
+  static void Work(FiberScheduler *scheduler, int worker);
+  Fiber *Take(int worker);
+  void Queued();
+  bool Idle();
+
+  std::vector<Fiber*> fibers;
+  std::vector<Worker*> workers;
+  std::atomic<int> running; //fibers not ended yet
+  std::atomic<int> queued; //fibers in any queue
+  std::atomic<int> sleeping; //workers waiting in Idle
+  std::mutex idleLock;
+  std::condition_variable wake; //a fiber was queued or the run ended
+  int slice;
+  int frameLimit;
+};
 
 #ifdef _MSC_VER
 
@@ -0,0 +1,207 @@
+#include <thread>
+#include "rvm_core.h"
+
+using namespace std;
+
+FiberScheduler::FiberScheduler(int workers, int slice) : running(0), queued(0), sleeping(0), slice(slice < 1 ? 1 : slice), frameLimit(FRAME_LIMIT)
+{
+  if(workers <= 0) workers = thread::hardware_concurrency();
+  if(workers <= 0) workers = 1; //unknown
+#ifdef RVM_SAMPLE
+  workers = 1; //the sampling timer belongs to the whole process
+#endif
+  for(int i1 = 0; i1 < workers; i1++)
+  {
+    Worker *worker = new Worker();
+    memset(&worker->stats, 0, sizeof(worker->stats));
+    this->workers.push_back(worker);
+  }
+}
+
+FiberScheduler::~FiberScheduler()
+{
+  clear();
+  for(size_t i1 = 0; i1 < workers.size(); i1++)
+  {
+    for(size_t i2 = 0; i2 < workers[i1]->spare.size(); i2++) delete workers[i1]->spare[i2];
+    delete workers[i1];
+  }
+}
+
+int FiberScheduler::spawn(const Program &program)
+{
+  Fiber *fiber = new Fiber();
+  fiber->program = &program;
+  fiber->vm = NULL;
+  fiber->status = RUN_YIELDED;
+  fiber->cycles = 0;
+  fiber->slices = 0;
+  fibers.push_back(fiber);
+  workers[(fibers.size() - 1) % workers.size()]->queue.push_back(fiber); //round robin
+  queued++;
+  return (int)fibers.size() - 1;
+}
+
+void FiberScheduler::clear()
+{
+  for(size_t i1 = 0; i1 < fibers.size(); i1++)
+  {
+    delete fibers[i1]->vm;
+    delete fibers[i1];
+  }
+  fibers.clear();
+  for(size_t i1 = 0; i1 < workers.size(); i1++) workers[i1]->queue.clear();
+  queued = 0;
+}
+
+//The front of the worker's own queue, or else the back of the first other
+//queue that has any, NULL if every queue is empty
+Fiber *FiberScheduler::Take(int worker)
+{
+  Worker *own = workers[worker];
+  {
+    lock_guard<mutex> guard(own->lock);
+    if(!own->queue.empty())
+    {
+      Fiber *fiber = own->queue.front();
+      own->queue.pop_front();
+      queued--;
+      return fiber;
+    }
+  }
+  for(size_t i1 = 1; i1 < workers.size(); i1++)
+  {
+    Worker *victim = workers[(worker + i1) % workers.size()];
+    lock_guard<mutex> guard(victim->lock);
+    if(!victim->queue.empty())
+    {
+      Fiber *fiber = victim->queue.back();
+      victim->queue.pop_back();
+      queued--;
+      own->stats.steals++;
+      return fiber;
+    }
+  }
+  return NULL;
+}
+
+//Wakes a sleeping worker for a fiber just put in a queue.  queued goes up
+//before sleeping is read and Idle does the opposite, so either the sleeper
+//sees the fiber or this sees the sleeper.
+void FiberScheduler::Queued()
+{
+  queued++;
+  if(sleeping > 0)
+  {
+    lock_guard<mutex> guard(idleLock);
+    wake.notify_one();
+  }
+}
+
+//Sleeps while every queue is empty and fibers are still running elsewhere.
+//Returns false once the run has ended.
+bool FiberScheduler::Idle()
+{
+  unique_lock<mutex> guard(idleLock);
+  sleeping++;
+  while(queued == 0 && running > 0) wake.wait(guard);
+  sleeping--;
+  return running > 0;
+}
+
+void FiberScheduler::Work(FiberScheduler *scheduler, int index)
+{
+  Worker *worker = scheduler->workers[index];
+  while(scheduler->running > 0)
+  {
+    Fiber *fiber = scheduler->Take(index);
+    if(fiber == NULL) //the rest are running on other workers
+    {
+      if(!scheduler->Idle()) break;
+      continue;
+    }
+
+    if(fiber->vm == NULL)
+    {
+      if(worker->spare.empty()) fiber->vm = new VM(FIBER_SEGMENT_SIZE);
+      else
+      {
+        fiber->vm = worker->spare.back();
+        worker->spare.pop_back();
+      }
+      fiber->vm->setFrameLimit(scheduler->frameLimit);
+    }
+    VM *vm = fiber->vm;
+    int before = (fiber->slices == 0 ? 0 : vm->getCycles());
+    fiber->status = vm->execute(*fiber->program, scheduler->slice);
+    fiber->slices++;
+    worker->stats.slices++;
+    worker->stats.instructions += vm->getCycles() - before;
+
+    if(fiber->status == RUN_YIELDED)
+    {
+      {
+        lock_guard<mutex> guard(worker->lock);
+        worker->queue.push_back(fiber);
+      }
+      scheduler->Queued();
+      continue;
+    }
+    fiber->cycles = vm->getCycles();
+    if(fiber->status == RUN_TRAPPED) fiber->trap = vm->getTrap();
+    fiber->vm = NULL;
+    if(worker->spare.size() < FIBER_SPARE_VMS)
+    {
+      vm->trimFrames(); //a deep fiber's segments are not kept for shallow ones
+      worker->spare.push_back(vm);
+    }
+    else delete vm;
+    worker->stats.ended++;
+    if(--scheduler->running == 0)
+    {
+      lock_guard<mutex> guard(scheduler->idleLock);
+      scheduler->wake.notify_all();
+    }
+  }
+}
+
+void FiberScheduler::run()
+{
+  int count = 0;
+  for(size_t i1 = 0; i1 < fibers.size(); i1++)
+  {
+    if(fibers[i1]->status == RUN_YIELDED) count++;
+  }
+  running = count;
+  for(size_t i1 = 0; i1 < workers.size(); i1++) memset(&workers[i1]->stats, 0, sizeof(workers[i1]->stats));
+
+  vector<thread> pool;
+  for(size_t i1 = 1; i1 < workers.size(); i1++) pool.push_back(thread(Work, this, (int)i1));
+  Work(this, 0); //the calling thread is worker 0
+  for(size_t i1 = 0; i1 < pool.size(); i1++) pool[i1].join();
+}
+
+int FiberScheduler::getWorkerCount()
+{
+  return (int)workers.size();
+}
+
+int FiberScheduler::getFiberCount()
+{
+  return (int)fibers.size();
+}
+
+const Fiber &FiberScheduler::getFiber(int index)
+{
+  return *fibers[index];
+}
+
+FiberWorkerStats FiberScheduler::getWorkerStats(int worker)
+{
+  return workers[worker]->stats;
+}
+
+void FiberScheduler::setFrameLimit(int bytes)
+{
+  frameLimit = bytes;
+}
@@ -0,0 +1,48 @@
+//Every opcode of the bytecode, for the INSTRUCTION macro of whoever includes
+//this file.  rvm_core.h turns each line into a constant and rvm_core.cpp
+//into a row of its name table.  No include guard on purpose.
+
+//BEGIN INSTRUCTIONS
+
+INSTRUCTION(INST_NOP        , 0x04)
+INSTRUCTION(INST_ADDS       , 0x05)
+INSTRUCTION(INST_SUBS       , 0x06)
+INSTRUCTION(INST_MULTS      , 0x07)
+INSTRUCTION(INST_DIVS       , 0x08)
+INSTRUCTION(INST_ADDSF      , 0x09)
+INSTRUCTION(INST_SUBSF      , 0x0A)
+INSTRUCTION(INST_MULTSF     , 0x0B)
+INSTRUCTION(INST_DIVSF      , 0x0C)
+INSTRUCTION(INST_PRINT      , 0x10)
+INSTRUCTION(INST_JMP        , 0x11)
+INSTRUCTION(INST_PUSH       , 0x12) //push raw value
+INSTRUCTION(INST_POP        , 0x13)
+INSTRUCTION(INST_PUSHFRAME  , 0x14) //push stack frame
+INSTRUCTION(INST_POPFRAME   , 0x15)
+INSTRUCTION(INST_PUSHA      , 0x16) //push from an address
+INSTRUCTION(INST_POPA       , 0x17) //pop into an address
+INSTRUCTION(INST_PUSHC      , 0x18) //global constants
+INSTRUCTION(INST_PUSHVAR    , 0x19) //puts a variable on the stack frame
+INSTRUCTION(INST_CONCATSTRINGSTRING, 0x1A)
+INSTRUCTION(INST_CALL       , 0x1B) //CALL target argc: new frame, arguments popped into locals 0..argc-1
+INSTRUCTION(INST_RET        , 0x1C) //leave the frame, a return value stays on the operand stack
+INSTRUCTION(INST_ENTER      , 0x1D) //ENTER n: function entry with n zeroed locals, replaces PUSHFRAME and PUSHVARs
+INSTRUCTION(INST_YIELD      , 0x1E) //ends the slice of a budgeted run, "asm INST_YIELD;" in source
+
+//superinstructions, produced by the compiler's peephole pass
+INSTRUCTION(INST_DECLPOPA   , 0x20) //PUSHVAR; POPA a
+INSTRUCTION(INST_MOVA       , 0x21) //PUSHA a; POPA b
+INSTRUCTION(INST_ADDA       , 0x22) //PUSHA a; ADDS
+INSTRUCTION(INST_ADDC       , 0x23) //PUSH k; ADDS
+INSTRUCTION(INST_ADDAA      , 0x24) //PUSHA a; PUSHA b; ADDS
+INSTRUCTION(INST_ADDAC      , 0x25) //PUSHA a; PUSH k; ADDS
+INSTRUCTION(INST_ADDAAPOPA  , 0x26) //PUSHA a; PUSHA b; ADDS; POPA c
+INSTRUCTION(INST_ADDACPOPA  , 0x27) //PUSHA a; PUSH k; ADDS; POPA c
+INSTRUCTION(INST_PRINTA     , 0x28) //PUSHA a; PRINT
+INSTRUCTION(INST_SETC       , 0x29) //PUSH k; POPA a
+INSTRUCTION(INST_ADDAPOPA   , 0x2A) //PUSHA a; ADDS; POPA c
+INSTRUCTION(INST_ADDCPOPA   , 0x2B) //PUSH k; ADDS; POPA c
+INSTRUCTION(INST_DECLC      , 0x2C) //PUSHVAR; PUSH k; POPA a
+INSTRUCTION(INST_ADDSPOPA   , 0x2D) //ADDS; POPA c
+
+//END INST
@@ -0,0 +1,483 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "rvm_core.h"
+
+#ifdef RVM_JIT
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+#ifdef RVM_JIT
+
+//Baseline template JIT for x86-64 Linux.  Only leaf functions are compiled:
+//a function body is straight line code, so a function without calls is one
+//basic block from its entry to its RET and operand stack values can be kept
+//in registers by simulating the stack while emitting code.  Values that do
+//not fit in registers, or that must survive a call into C, are written to
+//the VM's operand stack.
+//
+//Jump and call targets are not patched into the generated code.  A function
+//with a JMP or CALL is not compiled at all: frames, budgets and profiling
+//belong to the interpreter, and compiled code would have to return to it at
+//every call anyway.
+//
+//Generated code is called as int *fn(int *locals, int *sp, VM *vm)
+//where sp points at the top value of the operand stack, and returns the new
+//sp.  rbx holds locals, r12 the entry sp and r13 the VM, for PRINT.
+
+enum
+{
+  JIT_PUSHK, //push a constant
+  JIT_PUSHL, //push a local
+  JIT_POPL, //pop into a local
+  JIT_DROP,
+  JIT_ADD,
+  JIT_PRINT
+};
+
+typedef struct _JitOp
+{
+  int op;
+  int arg;
+} JitOp;
+
+#define X64_RAX 0
+#define X64_RCX 1
+#define X64_RDX 2
+#define X64_RBX 3
+#define X64_RSI 6
+#define X64_RDI 7
+#define X64_R12 12
+#define X64_R13 13
+
+static const int stackRegs[] = {X64_RAX, X64_RCX, X64_RDX, X64_RSI, X64_RDI, 8, 9, 10, 11}; //caller saved
+#define STACK_REGS ((int)(sizeof(stackRegs) / sizeof(stackRegs[0])))
+
+typedef struct _JitSlot
+{
+  bool constant;
+  int value; //the constant or the register
+} JitSlot;
+
+//Goes into the VM's output buffer like an interpreted PRINT
+void JitPrint(VM *vm, int ptr)
+{
+  vm->Print(ptr);
+}
+
+//Breaks a decoded instruction into the primitive operations the code
+//generator knows.  Superinstructions are split again, the register cache
+//gets the benefit back.  False if the instruction cannot be compiled.
+static bool Expand(const DecodedInstruction &inst, vector<JitOp> &ops)
+{
+  JitOp a, b, c, d;
+  int count = 0;
+  switch(inst.opcode)
+  {
+    case INST_NOP:
+    case INST_PUSHVAR:
+      break;
+    case INST_PUSH:
+    case INST_PUSHC:
+      a.op = JIT_PUSHK; a.arg = inst.operand; count = 1;
+      break;
+    case INST_POP:
+      a.op = JIT_DROP; a.arg = 0; count = 1;
+      break;
+    case INST_PUSHA:
+      a.op = JIT_PUSHL; a.arg = inst.operand; count = 1;
+      break;
+    case INST_POPA:
+    case INST_DECLPOPA:
+      a.op = JIT_POPL; a.arg = inst.operand; count = 1;
+      break;
+    case INST_ADDS:
+      a.op = JIT_ADD; a.arg = 0; count = 1;
+      break;
+    case INST_PRINT:
+      a.op = JIT_PRINT; a.arg = 0; count = 1;
+      break;
+    case INST_MOVA:
+      a.op = JIT_PUSHL; a.arg = inst.operand;
+      b.op = JIT_POPL; b.arg = inst.operand2; count = 2;
+      break;
+    case INST_ADDA:
+      a.op = JIT_PUSHL; a.arg = inst.operand;
+      b.op = JIT_ADD; b.arg = 0; count = 2;
+      break;
+    case INST_ADDC:
+      a.op = JIT_PUSHK; a.arg = inst.operand;
+      b.op = JIT_ADD; b.arg = 0; count = 2;
+      break;
+    case INST_ADDAA:
+      a.op = JIT_PUSHL; a.arg = inst.operand;
+      b.op = JIT_PUSHL; b.arg = inst.operand2;
+      c.op = JIT_ADD; c.arg = 0; count = 3;
+      break;
+    case INST_ADDAC:
+      a.op = JIT_PUSHL; a.arg = inst.operand;
+      b.op = JIT_PUSHK; b.arg = inst.operand2;
+      c.op = JIT_ADD; c.arg = 0; count = 3;
+      break;
+    case INST_ADDAAPOPA:
+      a.op = JIT_PUSHL; a.arg = inst.operand;
+      b.op = JIT_PUSHL; b.arg = inst.operand2;
+      c.op = JIT_ADD; c.arg = 0;
+      d.op = JIT_POPL; d.arg = inst.operand3; count = 4;
+      break;
+    case INST_ADDACPOPA:
+      a.op = JIT_PUSHL; a.arg = inst.operand;
+      b.op = JIT_PUSHK; b.arg = inst.operand2;
+      c.op = JIT_ADD; c.arg = 0;
+      d.op = JIT_POPL; d.arg = inst.operand3; count = 4;
+      break;
+    case INST_PRINTA:
+      a.op = JIT_PUSHL; a.arg = inst.operand;
+      b.op = JIT_PRINT; b.arg = 0; count = 2;
+      break;
+    case INST_SETC:
+    case INST_DECLC:
+      a.op = JIT_PUSHK; a.arg = inst.operand2;
+      b.op = JIT_POPL; b.arg = inst.operand; count = 2;
+      break;
+    case INST_ADDAPOPA:
+      a.op = JIT_PUSHL; a.arg = inst.operand;
+      b.op = JIT_ADD; b.arg = 0;
+      c.op = JIT_POPL; c.arg = inst.operand2; count = 3;
+      break;
+    case INST_ADDCPOPA:
+      a.op = JIT_PUSHK; a.arg = inst.operand;
+      b.op = JIT_ADD; b.arg = 0;
+      c.op = JIT_POPL; c.arg = inst.operand2; count = 3;
+      break;
+    case INST_ADDSPOPA:
+      a.op = JIT_ADD; a.arg = 0;
+      b.op = JIT_POPL; b.arg = inst.operand; count = 2;
+      break;
+    default:
+      return false;
+  }
+  if(count > 0) ops.push_back(a);
+  if(count > 1) ops.push_back(b);
+  if(count > 2) ops.push_back(c);
+  if(count > 3) ops.push_back(d);
+  return true;
+}
+
+class JitEmitter
+{
+public:
+  JitEmitter() : memTop(0)
+  {
+    for(int i1 = 0; i1 < STACK_REGS; i1++) regFree[i1] = true;
+  }
+
+  vector<unsigned char> out;
+
+  void Prologue()
+  {
+    Byte(0x53); //push rbx
+    Byte(0x41); Byte(0x54); //push r12
+    Byte(0x41); Byte(0x55); //push r13, rsp is 16 byte aligned from here on
+    Mov64(X64_RBX, X64_RDI);
+    Mov64(X64_R12, X64_RSI);
+    Mov64(X64_R13, X64_RDX);
+  }
+
+  void Epilogue()
+  {
+    Flush();
+    Byte(0x49); Byte(0x8D); MemOperand(X64_RAX, X64_R12, memTop * 4); //lea rax, [r12 + top]
+    Byte(0x41); Byte(0x5D); //pop r13
+    Byte(0x41); Byte(0x5C); //pop r12
+    Byte(0x5B); //pop rbx
+    Byte(0xC3); //ret
+  }
+
+  void Emit(const JitOp &op)
+  {
+    switch(op.op)
+    {
+      case JIT_PUSHK:
+      {
+        JitSlot slot;
+        slot.constant = true;
+        slot.value = op.arg;
+        vstack.push_back(slot);
+        break;
+      }
+      case JIT_PUSHL:
+      {
+        JitSlot slot;
+        slot.constant = false;
+        slot.value = Alloc();
+        Load(slot.value, X64_RBX, op.arg * 4);
+        vstack.push_back(slot);
+        break;
+      }
+      case JIT_POPL:
+      {
+        JitSlot slot = Pop();
+        if(slot.constant) StoreImm(X64_RBX, op.arg * 4, slot.value);
+        else
+        {
+          Store(X64_RBX, op.arg * 4, slot.value);
+          Free(slot.value);
+        }
+        break;
+      }
+      case JIT_DROP:
+      {
+        if(vstack.empty()) memTop--;
+        else
+        {
+          if(!vstack.back().constant) Free(vstack.back().value);
+          vstack.pop_back();
+        }
+        break;
+      }
+      case JIT_ADD:
+      {
+        JitSlot b = Pop();
+        JitSlot a = Pop();
+        JitSlot sum;
+        if(a.constant && b.constant)
+        {
+          sum.constant = true;
+          sum.value = (int)((unsigned int)a.value + (unsigned int)b.value);
+        }
+        else if(b.constant)
+        {
+          AddImm(a.value, b.value);
+          sum = a;
+        }
+        else if(a.constant)
+        {
+          AddImm(b.value, a.value);
+          sum = b;
+        }
+        else
+        {
+          AddReg(a.value, b.value);
+          Free(b.value);
+          sum = a;
+        }
+        vstack.push_back(sum);
+        break;
+      }
+      case JIT_PRINT:
+      {
+        JitSlot ptr = Pop();
+        Flush(); //everything else lives in memory across the call
+        if(ptr.constant) MovImm(X64_RSI, ptr.value);
+        else
+        {
+          if(ptr.value != X64_RSI) Mov32(X64_RSI, ptr.value);
+          Free(ptr.value);
+        }
+        Mov64(X64_RDI, X64_R13);
+        Byte(0x48); Byte(0xB8); //mov rax, imm64
+        unsigned long long target = (unsigned long long)(size_t)&JitPrint;
+        for(int i1 = 0; i1 < 8; i1++) Byte((unsigned char)(target >> (i1 * 8)));
+        Byte(0xFF); Byte(0xD0); //call rax
+        break;
+      }
+    }
+  }
+
+private:
+  vector<JitSlot> vstack; //values above memTop, bottom first
+  int memTop; //position of the topmost value in memory relative to the entry sp
+  bool regFree[STACK_REGS];
+
+  void Byte(unsigned char b)
+  {
+    out.push_back(b);
+  }
+
+  void Imm32(int v)
+  {
+    for(int i1 = 0; i1 < 4; i1++) Byte((unsigned char)((unsigned int)v >> (i1 * 8)));
+  }
+
+  void Rex(bool wide, int reg, int rm)
+  {
+    unsigned char rex = 0x40 | (wide ? 0x08 : 0) | (((reg >> 3) & 1) << 2) | ((rm >> 3) & 1);
+    if(rex != 0x40) Byte(rex);
+  }
+
+  void MemOperand(int reg, int base, int disp) //[base + disp32]
+  {
+    Byte(0x80 | ((reg & 7) << 3) | (base & 7));
+    if((base & 7) == 4) Byte(0x24); //rsp and r12 need a SIB byte
+    Imm32(disp);
+  }
+
+  void Load(int reg, int base, int disp) //mov r32, [base + disp]
+  {
+    Rex(false, reg, base);
+    Byte(0x8B);
+    MemOperand(reg, base, disp);
+  }
+
+  void Store(int base, int disp, int reg) //mov [base + disp], r32
+  {
+    Rex(false, reg, base);
+    Byte(0x89);
+    MemOperand(reg, base, disp);
+  }
+
+  void StoreImm(int base, int disp, int imm) //mov dword [base + disp], imm32
+  {
+    Rex(false, 0, base);
+    Byte(0xC7);
+    MemOperand(0, base, disp);
+    Imm32(imm);
+  }
+
+  void MovImm(int reg, int imm) //mov r32, imm32
+  {
+    Rex(false, 0, reg);
+    Byte(0xB8 + (reg & 7));
+    Imm32(imm);
+  }
+
+  void Mov32(int dst, int src)
+  {
+    Rex(false, src, dst);
+    Byte(0x89);
+    Byte(0xC0 | ((src & 7) << 3) | (dst & 7));
+  }
+
+  void Mov64(int dst, int src)
+  {
+    Rex(true, src, dst);
+    Byte(0x89);
+    Byte(0xC0 | ((src & 7) << 3) | (dst & 7));
+  }
+
+  void AddImm(int reg, int imm) //add r32, imm32
+  {
+    Rex(false, 0, reg);
+    Byte(0x81);
+    Byte(0xC0 | (reg & 7));
+    Imm32(imm);
+  }
+
+  void AddReg(int dst, int src) //add r32, r32
+  {
+    Rex(false, src, dst);
+    Byte(0x01);
+    Byte(0xC0 | ((src & 7) << 3) | (dst & 7));
+  }
+
+  void Free(int reg)
+  {
+    for(int i1 = 0; i1 < STACK_REGS; i1++)
+    {
+      if(stackRegs[i1] == reg) regFree[i1] = true;
+    }
+  }
+
+  //Writes the bottom value of the register stack to memory
+  void SpillBottom()
+  {
+    JitSlot slot = vstack.front();
+    vstack.erase(vstack.begin());
+    memTop++;
+    if(slot.constant) StoreImm(X64_R12, memTop * 4, slot.value);
+    else
+    {
+      Store(X64_R12, memTop * 4, slot.value);
+      Free(slot.value);
+    }
+  }
+
+  void Flush()
+  {
+    while(!vstack.empty()) SpillBottom();
+  }
+
+  int Alloc()
+  {
+    for(;;)
+    {
+      for(int i1 = 0; i1 < STACK_REGS; i1++)
+      {
+        if(regFree[i1])
+        {
+          regFree[i1] = false;
+          return stackRegs[i1];
+        }
+      }
+      SpillBottom(); //all registers hold values, at least one of them is in vstack
+    }
+  }
+
+  JitSlot Pop()
+  {
+    JitSlot slot;
+    if(vstack.empty()) //the value is in memory
+    {
+      slot.constant = false;
+      slot.value = Alloc();
+      Load(slot.value, X64_R12, memTop * 4);
+      memTop--;
+      return slot;
+    }
+    slot = vstack.back();
+    vstack.pop_back();
+    return slot;
+  }
+};
+
+JitFunction JitCompile(const vector<DecodedInstruction> &code, int entry, int *instructions, int *ret, size_t *size)
+{
+  vector<JitOp> ops;
+  int ip = entry + 1;
+  for(; code[ip].opcode != INST_RET && code[ip].opcode != INST_POPFRAME; ip++)
+  {
+    if(!Expand(code[ip], ops)) return NULL; //calls, jumps and anything else stay interpreted
+  }
+
+  JitEmitter emitter;
+  emitter.Prologue();
+  for(size_t i1 = 0; i1 < ops.size(); i1++) emitter.Emit(ops[i1]);
+  emitter.Epilogue();
+
+  size_t length = emitter.out.size();
+  void *mem = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(mem == MAP_FAILED) return NULL;
+  memcpy(mem, &emitter.out[0], length);
+  if(mprotect(mem, length, PROT_READ | PROT_EXEC) != 0)
+  {
+    munmap(mem, length);
+    return NULL;
+  }
+
+  *instructions = ip - entry - 1;
+  *ret = ip;
+  *size = length;
+  return (JitFunction)mem;
+}
+
+void JitFree(JitFunction fn, size_t size)
+{
+  munmap((void*)fn, size);
+}
+
+#else
+
+JitFunction JitCompile(const vector<DecodedInstruction> &code, int entry, int *instructions, int *ret, size_t *size)
+{
+  return NULL;
+}
+
+void JitFree(JitFunction fn, size_t size)
+{
+}
+
+#endif
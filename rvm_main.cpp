@@ -0,0 +1,472 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdexcept>
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+#include "rvm_compiler.h"
+
+using namespace std;
+
+char *readFileByteCode(char *exe, int *length)
+{
+  ifstream file(exe);
+  if(!file.is_open())
+  {
+    printf("File could not be opened\n");
+    system("Pause");
+    return NULL;
+  }
+
+  file.seekg(0, file.end);
+  int filelen = file.tellg();
+  file.seekg(0, file.beg);
+
+  char *code = new char[filelen + 1];
+  file.read(code, filelen);
+
+  *length = filelen;
+  return code;
+}
+
+//The command line.  Without a command main keeps the old interactive
+//driver; every command below runs without reading stdin, reports each file
+//on stderr and exits with 1 if any file failed, so it can run unattended.
+
+static void PrintUsage()
+{
+  fprintf(stderr,
+          "usage: vm compile [-j threads] [-q] path...          writes <file>.rexe and <file>.rexe.sym\n"
+          "       vm run [-j threads] [-q] path...              runs .rexe files\n"
+          "       vm compile-and-run [-j threads] [-q] path...  compiles, then runs what compiled\n"
+          "       vm -run file.rexe                              runs one file\n"
+          "       vm                                             asks for a file to compile\n"
+          "A directory stands for the .rvm (or for run, .rexe) files anywhere below it.\n"
+          "-j takes a number of threads from 1 up, the default is 1. -q reports only errors.\n");
+}
+
+//The VM's output only carries what the program prints, the drivers add the
+//cycle count themselves once it has been flushed
+static void WriteCompleted(VM &vm, OutputSink &out)
+{
+  char line[64];
+  out.write(line, snprintf(line, sizeof(line), "\nExecution completed in %d cycles\n", vm.getCycles()));
+}
+
+//A whole number of at least 1, or 0 for anything else
+static int ParseCount(const char *text)
+{
+  if(!isdigit((unsigned char)text[0])) return 0;
+  char *end;
+  errno = 0;
+  long value = strtol(text, &end, 10);
+  if(*end != '\0' || errno != 0 || value < 1 || value > INT_MAX) return 0;
+  return (int)value;
+}
+
+static bool IsDirectory(const string &path)
+{
+#ifdef _WIN32
+  DWORD attributes = GetFileAttributesA(path.c_str());
+  return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+  struct stat info;
+  return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+#endif
+}
+
+static bool EndsWith(const string &str, const char *suffix)
+{
+  size_t length = strlen(suffix);
+  return str.size() >= length && str.compare(str.size() - length, length, suffix) == 0;
+}
+
+//A file is added as it is, a directory adds the files below it that end in
+//extension, in name order
+static void CollectFiles(const string &path, const char *extension, vector<string> &files)
+{
+  if(!IsDirectory(path))
+  {
+    files.push_back(path);
+    return;
+  }
+
+  vector<string> names;
+#ifdef _WIN32
+  WIN32_FIND_DATAA found;
+  HANDLE find = FindFirstFileA((path + "\\*").c_str(), &found);
+  if(find != INVALID_HANDLE_VALUE)
+  {
+    do names.push_back(found.cFileName); while(FindNextFileA(find, &found));
+    FindClose(find);
+  }
+#else
+  DIR *dir = opendir(path.c_str());
+  if(dir != NULL)
+  {
+    for(struct dirent *entry = readdir(dir); entry != NULL; entry = readdir(dir)) names.push_back(entry->d_name);
+    closedir(dir);
+  }
+#endif
+  sort(names.begin(), names.end());
+  for(size_t i1 = 0; i1 < names.size(); i1++)
+  {
+    if(names[i1] == "." || names[i1] == "..") continue;
+    string full = path + "/" + names[i1];
+    if(IsDirectory(full)) CollectFiles(full, extension, files);
+    else if(EndsWith(full, extension)) files.push_back(full);
+  }
+}
+
+static char *LoadFile(const char *name, int *length)
+{
+  ifstream file(name, ios::binary);
+  if(!file.is_open()) return NULL;
+
+  file.seekg(0, file.end);
+  int filelen = file.tellg();
+  file.seekg(0, file.beg);
+
+  char *code = new char[filelen + 1];
+  file.read(code, filelen);
+  *length = filelen;
+  return code;
+}
+
+static bool WriteFile(const string &name, const char *data, int length)
+{
+  ofstream out(name.c_str(), ios::binary);
+  if(!out.is_open()) return false;
+  out.write(data, length);
+  return out.good();
+}
+
+typedef struct _RunJob
+{
+  string path; //of the .rexe, which need not exist when compiled in process
+  char *bytecode;
+  int length;
+  SymbolTable *symbols; //NULL if unknown
+  long long instructions;
+  string error; //empty on success
+  double seconds;
+} RunJob;
+
+typedef struct _RunBatch
+{
+  vector<RunJob> *jobs;
+  VMPool pool; //a thread's VM is warm for its next job
+  mutex outputLock; //held while a finished job's output goes to stdout
+} RunBatch;
+
+static void RunJobAt(void *data, int index, int)
+{
+  RunBatch *batch = (RunBatch*)data;
+  RunJob &job = (*batch->jobs)[index];
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  job.instructions = 0;
+  MemorySink output; //written out in one piece, so jobs on other threads cannot cut into it
+  VM *vm = batch->pool.acquire();
+  vm->setOutput(&output);
+  try
+  {
+#if defined(RVM_PROFILE) || defined(RVM_SAMPLE)
+    vm->setSymbols(job.symbols != NULL ? *job.symbols : SymbolTable());
+    vm->setProfileOutput((job.path + ".profile.json").c_str());
+    vm->setSampleOutput((job.path + ".samples.collapsed").c_str(), true);
+#endif
+    vm->execute(job.bytecode, job.length);
+    WriteCompleted(*vm, output);
+    job.instructions = vm->getCycles();
+  }
+  catch(exception &e)
+  {
+    job.error = e.what();
+  }
+  vm->setOutput(NULL); //the pool keeps the VM, output does not outlive this job
+  batch->pool.release(vm);
+  if(!output.getText().empty())
+  {
+    lock_guard<mutex> guard(batch->outputLock);
+    fwrite(output.getText().data(), 1, output.getText().size(), stdout);
+    fflush(stdout);
+  }
+  job.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+//Runs every job, returns how many failed
+static int RunJobs(vector<RunJob> &jobs, int threads, bool quiet)
+{
+#ifdef RVM_SAMPLE
+  threads = 1; //the sampling timer belongs to the whole process
+#endif
+  RunBatch batch;
+  batch.jobs = &jobs;
+  ParallelFor(jobs.size(), threads, RunJobAt, &batch);
+  int failed = 0;
+  for(size_t i1 = 0; i1 < jobs.size(); i1++)
+  {
+    if(!jobs[i1].error.empty())
+    {
+      fprintf(stderr, "error %s: %s\n", jobs[i1].path.c_str(), jobs[i1].error.c_str());
+      failed++;
+    }
+    else if(!quiet) fprintf(stderr, "ran %s in %.2f ms, %lld instructions\n", jobs[i1].path.c_str(), jobs[i1].seconds * 1e3, jobs[i1].instructions);
+  }
+  return failed;
+}
+
+static int RunCommand(int argc, char **argv)
+{
+  const char *command = argv[1];
+  bool compile = strcmp(command, "compile") == 0 || strcmp(command, "compile-and-run") == 0;
+  bool run = strcmp(command, "run") == 0 || strcmp(command, "compile-and-run") == 0;
+  int threads = 1;
+  bool quiet = false;
+  vector<string> files;
+  for(int i1 = 2; i1 < argc; i1++)
+  {
+    if(strcmp(argv[i1], "-j") == 0)
+    {
+      threads = (i1 + 1 < argc ? ParseCount(argv[++i1]) : 0);
+      if(threads == 0)
+      {
+        fprintf(stderr, "-j needs a number of threads from 1 up\n");
+        PrintUsage();
+        return 2;
+      }
+    }
+    else if(strcmp(argv[i1], "-q") == 0) quiet = true;
+    else if(argv[i1][0] == '-')
+    {
+      PrintUsage();
+      return 2;
+    }
+    else CollectFiles(argv[i1], compile ? ".rvm" : ".rexe", files);
+  }
+  if(files.empty())
+  {
+    PrintUsage();
+    return 2;
+  }
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  int failed = 0;
+  vector<RunJob> runs;
+  vector<CompileJob> compiles;
+  if(compile)
+  {
+    compiles.resize(files.size());
+    for(size_t i1 = 0; i1 < files.size(); i1++) compiles[i1].path = files[i1];
+    CompileFiles(compiles, threads);
+    for(size_t i1 = 0; i1 < compiles.size(); i1++)
+    {
+      CompileJob &job = compiles[i1];
+      string outName = job.path + ".rexe";
+      if(job.error.empty() && (!WriteFile(outName, job.bytecode, job.length) || !SaveSymbols((outName + ".sym").c_str(), job.symbols)))
+      {
+        job.error = outName + " could not be written";
+      }
+      if(!job.error.empty())
+      {
+        fprintf(stderr, "error %s: %s\n", job.path.c_str(), job.error.c_str());
+        failed++;
+        continue;
+      }
+      if(!quiet) fprintf(stderr, "compiled %s in %.2f ms, %d bytes\n", job.path.c_str(), job.seconds * 1e3, job.length);
+      RunJob runJob;
+      runJob.path = outName;
+      runJob.bytecode = job.bytecode;
+      runJob.length = job.length;
+      runJob.symbols = &job.symbols;
+      runs.push_back(runJob);
+    }
+  }
+  else
+  {
+    for(size_t i1 = 0; i1 < files.size(); i1++)
+    {
+      RunJob job;
+      job.path = files[i1];
+      job.bytecode = LoadFile(files[i1].c_str(), &job.length);
+      job.symbols = NULL;
+      if(job.bytecode == NULL)
+      {
+        fprintf(stderr, "error %s: File could not be opened\n", files[i1].c_str());
+        failed++;
+        continue;
+      }
+      runs.push_back(job);
+    }
+  }
+
+#if defined(RVM_PROFILE) || defined(RVM_SAMPLE)
+  vector<SymbolTable> loaded(runs.size());
+  for(size_t i1 = 0; i1 < runs.size(); i1++)
+  {
+    if(runs[i1].symbols == NULL && LoadSymbols((runs[i1].path + ".sym").c_str(), loaded[i1])) runs[i1].symbols = &loaded[i1];
+  }
+#endif
+  if(run) failed += RunJobs(runs, threads, quiet);
+
+  if(compile)
+  {
+    for(size_t i1 = 0; i1 < compiles.size(); i1++) delete[] compiles[i1].bytecode;
+  }
+  else
+  {
+    for(size_t i1 = 0; i1 < runs.size(); i1++) delete[] runs[i1].bytecode;
+  }
+  double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  fprintf(stderr, "%d files, %d failed, %.2f ms\n", (int)files.size(), failed, secs * 1e3);
+  return failed > 0 ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+  PopulateTokenMap();
+
+  if(argc > 1 && (strcmp(argv[1], "compile") == 0 || strcmp(argv[1], "run") == 0 || strcmp(argv[1], "compile-and-run") == 0))
+  {
+    return RunCommand(argc, argv);
+  }
+
+  if(argc > 2 && strcmp("-run", argv[1]) == 0)
+  {
+    char *exe = argv[2];
+
+    int length;
+    char *bc = readFileByteCode(exe, &length);
+    if(bc == NULL)
+      return 1;
+
+    VM vm;
+#if defined(RVM_PROFILE) || defined(RVM_SAMPLE)
+    {
+      string exeName = exe;
+      SymbolTable symbols;
+      if(LoadSymbols((exeName + ".sym").c_str(), symbols)) vm.setSymbols(symbols);
+      vm.setProfileOutput((exeName + ".profile.json").c_str());
+      vm.setSampleOutput((exeName + ".samples.collapsed").c_str(), true);
+    }
+#endif
+    try
+    {
+      vm.execute(bc, length);
+      FdSink stdoutSink;
+      WriteCompleted(vm, stdoutSink);
+    }
+    catch(runtime_error &e)
+    {
+      printf("%s\n", e.what());
+    }
+
+    delete[] bc;
+    return 0;
+  }
+
+  if(argc > 1)
+  {
+    PrintUsage();
+    return 2;
+  }
+
+  char filename[1024];
+  printf("Enter name of file to compile: ");
+  fgets(filename, 1024, stdin);
+
+  if(filename[strlen(filename) - 1] == '\n')
+    filename[strlen(filename) - 1] = '\0';
+
+  SourceFile source;
+  if(!source.open(filename))
+  {
+    printf("File could not be opened\n");
+    system("Pause");
+    return 0;
+  }
+
+  printf("Compiling to bytecode...\n");
+  int length;
+  SymbolTable symbols;
+  char *bytecode;
+  try
+  {
+    vector<Token> tokens = Tokenize(source.data, source.length);
+    /*
+    for(int i1 = 0; i1 < tokens.size(); i1++)
+    {
+      PrintToken(tokens[i1], source.data);
+    }
+    */
+    bytecode = CompileToBytecode(tokens, &length, &symbols);
+  }
+  catch(runtime_error &e)
+  {
+    printf("%s\n", e.what());
+    return 1;
+  }
+  char outName[1024];
+  {
+    strcpy(outName, filename);
+    strcat(outName, ".rexe");
+    ofstream out(outName);
+    out.write(bytecode, length);
+    out.close();
+
+    string symName = string(outName) + ".sym";
+    SaveSymbols(symName.c_str(), symbols);
+  }
+  printf("0x");
+  for(int i1 = 0; i1 < length; i1++)
+  {
+    printf("%02x", bytecode[i1]);
+  }
+  printf("\nWould you like to execute this code (y/n)? ");
+  char c;
+  scanf(" %c", &c);
+  printf("\n");
+  if(c == 'y')
+  {
+    VM vm;
+#if defined(RVM_PROFILE) || defined(RVM_SAMPLE)
+    vm.setSymbols(symbols);
+    vm.setProfileOutput((string(outName) + ".profile.json").c_str());
+    vm.setSampleOutput((string(outName) + ".samples.collapsed").c_str(), true);
+#endif
+    try
+    {
+      vm.execute(bytecode, length);
+      FdSink stdoutSink;
+      WriteCompleted(vm, stdoutSink);
+    }
+    catch(runtime_error &e)
+    {
+      printf("%s\n", e.what());
+    }
+  }
+  delete[] bytecode;
+  {
+    int junk;
+    scanf("%d\n", &junk);
+  }
+  return 0;
+}
+
+
+
@@ -0,0 +1,107 @@
+#include <stdexcept>
+#include "rvm_core.h"
+
+using namespace std;
+
+VMPool::VMPool(size_t retainLimit) : retainLimit(retainLimit)
+{
+  memset(&stats, 0, sizeof(stats));
+}
+
+VMPool::~VMPool()
+{
+  for(size_t i1 = 0; i1 < idle.size(); i1++) delete idle[i1];
+}
+
+//An idle VM, one that has program loaded if there is one.  Idle VMs are
+//only ever looked at from the most recently released end, so a pool that
+//runs one program mostly takes the last VM.
+VM *VMPool::take(const Program *program)
+{
+  lock_guard<mutex> guard(lock);
+  stats.acquires++;
+  if(idle.empty())
+  {
+    stats.misses++;
+    return NULL;
+  }
+
+  size_t found = idle.size() - 1;
+  if(program != NULL)
+  {
+    for(size_t i1 = idle.size(); i1-- > 0;)
+    {
+      if(idle[i1]->hasLoaded(*program))
+      {
+        found = i1;
+        stats.programHits++;
+        break;
+      }
+    }
+  }
+  VM *vm = idle[found];
+  idle.erase(idle.begin() + found);
+  stats.hits++;
+  stats.idle = (int)idle.size();
+  stats.retainedBytes -= vm->getMemory();
+  return vm;
+}
+
+VM *VMPool::acquire()
+{
+  VM *vm = take(NULL);
+  return (vm != NULL ? vm : new VM());
+}
+
+VM *VMPool::acquire(const Program &program)
+{
+  VM *vm = take(&program);
+  if(vm == NULL) vm = new VM();
+  try
+  {
+    vm->load(program);
+  }
+  catch(...)
+  {
+    release(vm);
+    throw;
+  }
+  return vm;
+}
+
+void VMPool::release(VM *vm)
+{
+  if(vm == NULL) return;
+  int frameHighWater = vm->getFrameHighWater();
+  if(vm->isSuspended()) vm->reset(); //nobody may resume it by accident
+  lock_guard<mutex> guard(lock);
+  if(frameHighWater > stats.frameHighWater) stats.frameHighWater = frameHighWater;
+
+  size_t memory = vm->getMemory();
+  if(stats.retainedBytes + memory > retainLimit)
+  {
+    vm->trimFrames();
+    memory = vm->getMemory();
+  }
+  if(stats.retainedBytes + memory > retainLimit)
+  {
+    stats.discarded++;
+    delete vm;
+    return;
+  }
+  idle.push_back(vm);
+  stats.idle = (int)idle.size();
+  stats.retainedBytes += memory;
+}
+
+void VMPool::setRetainLimit(size_t bytes)
+{
+  lock_guard<mutex> guard(lock);
+  retainLimit = bytes;
+}
+
+VMPoolStats VMPool::getStats()
+{
+  lock_guard<mutex> guard(lock);
+  return stats;
+}
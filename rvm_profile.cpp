@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "rvm_core.h"
+
+using namespace std;
+
+static long long NowNs()
+{
+  return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Profiler::reset(size_t codeSize)
+{
+  memset(opcodeCounts, 0, sizeof(opcodeCounts));
+  functions.assign(codeSize, ProfileFunction());
+  for(size_t i1 = 0; i1 < codeSize; i1++)
+  {
+    functions[i1].calls = 0;
+    functions[i1].inclusiveNs = 0;
+    functions[i1].exclusiveNs = 0;
+    functions[i1].running = 0;
+  }
+  active.clear();
+  maxStackDepth = 0;
+  maxFrameDepth = 0;
+}
+
+void Profiler::enter(int entry)
+{
+  ProfileActivation act;
+  act.entry = entry;
+  act.childNs = 0;
+  act.start = NowNs();
+  active.push_back(act);
+  functions[entry].calls++;
+  functions[entry].running++;
+  if((int)active.size() > maxFrameDepth) maxFrameDepth = active.size();
+}
+
+void Profiler::leave()
+{
+  if(active.empty()) return;
+  ProfileActivation act = active.back();
+  active.pop_back();
+
+  long long elapsed = NowNs() - act.start;
+  ProfileFunction &fn = functions[act.entry];
+  fn.exclusiveNs += elapsed - act.childNs;
+  if(--fn.running == 0) fn.inclusiveNs += elapsed; //a recursive activation is inside the outer one's time
+  if(!active.empty()) active.back().childNs += elapsed;
+}
+
+void Profiler::finish()
+{
+  while(!active.empty()) leave();
+}
+
+static void WriteName(FILE *file, int offset, const SymbolTable &symbols)
+{
+  const Symbol *symbol = FindFunction(symbols, offset);
+  if(symbol == NULL || (int)symbol->address != offset)
+  {
+    fprintf(file, "\"fn_%d\"", offset);
+    return;
+  }
+  fputc('"', file);
+  for(const char *c = symbol->name; *c != '\0'; c++)
+  {
+    if(*c == '"' || *c == '\\') fputc('\\', file);
+    fputc(*c, file);
+  }
+  fputc('"', file);
+}
+
+//Writes the last run as JSON: totals, then every opcode that ran, then every
+//function that was called
+bool Profiler::write(const char *path, const vector<int> &offsets,
+                     const SymbolTable &symbols, int cycles, int frameHighWater)
+{
+  FILE *file = fopen(path, "w");
+  if(file == NULL) return false;
+
+  fprintf(file, "{\n  \"cycles\": %d,\n  \"maxStackDepth\": %d,\n  \"maxFrameDepth\": %d,\n  \"frameHighWaterBytes\": %d,\n",
+          cycles, maxStackDepth, maxFrameDepth, frameHighWater);
+
+  fprintf(file, "  \"opcodes\": [");
+  bool first = true;
+  for(int i1 = 0; i1 < DECODED_OPCODES; i1++)
+  {
+    if(opcodeCounts[i1] == 0) continue;
+    fprintf(file, "%s\n    {\"name\": \"%s\", \"opcode\": %d, \"count\": %lld}", first ? "" : ",", GetInstructionName(i1), i1, opcodeCounts[i1]);
+    first = false;
+  }
+  fprintf(file, "\n  ],\n");
+
+  fprintf(file, "  \"functions\": [");
+  first = true;
+  for(size_t i1 = 0; i1 < functions.size(); i1++)
+  {
+    if(functions[i1].calls == 0) continue;
+    fprintf(file, "%s\n    {\"name\": ", first ? "" : ",");
+    WriteName(file, offsets[i1], symbols);
+    fprintf(file, ", \"offset\": %d, \"calls\": %lld, \"inclusiveNs\": %lld, \"exclusiveNs\": %lld}",
+            offsets[i1], functions[i1].calls, functions[i1].inclusiveNs, functions[i1].exclusiveNs);
+    first = false;
+  }
+  fprintf(file, "\n  ]\n}\n");
+
+  return fclose(file) == 0;
+}
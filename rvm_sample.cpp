@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "rvm_core.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/time.h>
+#define RVM_SAMPLE_TIMER
+#endif
+
+using namespace std;
+
+static volatile sig_atomic_t *sampleFlag = NULL;
+
+#ifdef RVM_SAMPLE_TIMER
+static void OnProfileSignal(int)
+{
+  volatile sig_atomic_t *flag = sampleFlag;
+  if(flag != NULL) *flag = 0; //the interpreter samples at its next instruction
+}
+#endif
+
+bool Sampler::startTimer(int microseconds, volatile sig_atomic_t *flag)
+{
+#ifdef RVM_SAMPLE_TIMER
+  sampleFlag = flag;
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = OnProfileSignal;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if(sigaction(SIGPROF, &action, NULL) != 0) return false;
+
+  struct itimerval timer;
+  timer.it_interval.tv_sec = microseconds / 1000000;
+  timer.it_interval.tv_usec = microseconds % 1000000;
+  timer.it_value = timer.it_interval;
+  return setitimer(ITIMER_PROF, &timer, NULL) == 0;
+#else
+  return false;
+#endif
+}
+
+void Sampler::stopTimer()
+{
+#ifdef RVM_SAMPLE_TIMER
+  struct itimerval timer;
+  memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_PROF, &timer, NULL);
+#endif
+  sampleFlag = NULL;
+}
+
+void Sampler::reset()
+{
+  ring.resize(SAMPLE_RING_SIZE);
+  head.store(0);
+  tail.store(0);
+  stacks.clear();
+}
+
+bool Sampler::push(const Sample &sample)
+{
+  unsigned int h = head.load(memory_order_relaxed);
+  if(h - tail.load(memory_order_acquire) == SAMPLE_RING_SIZE) return false;
+  ring[h & (SAMPLE_RING_SIZE - 1)] = sample;
+  head.store(h + 1, memory_order_release);
+  return true;
+}
+
+bool Sampler::pop(Sample &sample)
+{
+  unsigned int t = tail.load(memory_order_relaxed);
+  if(t == head.load(memory_order_acquire)) return false;
+  sample = ring[t & (SAMPLE_RING_SIZE - 1)];
+  tail.store(t + 1, memory_order_release);
+  return true;
+}
+
+static void AppendFrame(string &stack, int offset, const SymbolTable &symbols, bool lines)
+{
+  char frame[64];
+  const Symbol *function = FindFunction(symbols, offset);
+  if(function != NULL) snprintf(frame, sizeof(frame), "%s", function->name);
+  else snprintf(frame, sizeof(frame), "0x%x", offset);
+  stack += frame;
+
+  const LineEntry *line = (lines ? FindLine(symbols, offset) : NULL);
+  if(line != NULL)
+  {
+    snprintf(frame, sizeof(frame), ":%d", line->line);
+    stack += frame;
+  }
+}
+
+void Sampler::drain(const SymbolTable &symbols, bool lines)
+{
+  Sample sample;
+  while(pop(sample))
+  {
+    string stack = (sample.truncated ? "[truncated]" : "");
+    for(int i1 = sample.depth - 1; i1 >= 0; i1--)
+    {
+      if(!stack.empty()) stack += ';';
+      AppendFrame(stack, sample.offsets[i1], symbols, lines);
+    }
+    stacks[stack]++;
+  }
+}
+
+bool Sampler::write(const char *path)
+{
+  FILE *file = fopen(path, "w");
+  if(file == NULL) return false;
+  for(map<string, long long>::iterator it = stacks.begin(); it != stacks.end(); ++it)
+  {
+    fprintf(file, "%s %lld\n", it->first.c_str(), it->second);
+  }
+  return fclose(file) == 0;
+}
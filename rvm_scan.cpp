@@ -0,0 +1,271 @@
+#include <string.h>
+#include "rvm_tokenmap.h"
+
+#if (defined(__x86_64__) || defined(__i386__) || defined(_M_X64)) && !defined(RVM_NO_SIMD)
+#define RVM_SCAN_X86
+#include <emmintrin.h>
+#endif
+
+#if defined(RVM_SCAN_X86) && (defined(__GNUC__) || defined(__clang__))
+#define RVM_SCAN_AVX2
+#include <immintrin.h>
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+//Kernels for the hot loops of Tokenize.  The vector versions test 16 or 32
+//bytes at once and leave the last partial block to the scalar ones, so they
+//never read past end.  The bytes a kernel stops at come
+//from CharClasses, so they always agree with the scalar lexer.
+
+ScanFunction ScanSpace;
+ScanFunction ScanWord;
+ScanFunction ScanQuote;
+ScanFunction ScanLine;
+
+static unsigned char spaceBytes[32]; //the CHAR_SPACE bytes
+static int spaceCount = 0;
+static unsigned char wordStopBytes[64]; //every byte that is not CHAR_OTHER
+static int wordStopCount = 0;
+
+//Most whitespace runs and words are a few bytes long, so the vector kernels
+//first look at this many bytes one at a time
+#define SCALAR_PREFIX 16
+
+static inline int CountTrailingZeros(unsigned int mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_ctz(mask);
+#else
+  int count = 0;
+  while(!(mask & 1))
+  {
+    mask >>= 1;
+    count++;
+  }
+  return count;
+#endif
+}
+
+static const char *ScanSpaceScalar(const char *ptr, const char *end)
+{
+  while(ptr < end && CharClasses[(unsigned char)*ptr] == CHAR_SPACE) ptr++;
+  return ptr;
+}
+
+static const char *ScanWordScalar(const char *ptr, const char *end)
+{
+  while(ptr < end && CharClasses[(unsigned char)*ptr] == CHAR_OTHER) ptr++;
+  return ptr;
+}
+
+static const char *ScanQuoteScalar(const char *ptr, const char *end)
+{
+  while(ptr < end && *ptr != '\"' && *ptr != '\\') ptr++;
+  return ptr;
+}
+
+static const char *ScanLineScalar(const char *ptr, const char *end)
+{
+  while(ptr < end && *ptr != '\n') ptr++;
+  return ptr;
+}
+
+#ifdef RVM_SCAN_X86
+static inline __m128i MatchAny16(__m128i block, const unsigned char *bytes, int count)
+{
+  __m128i match = _mm_setzero_si128();
+  for(int i1 = 0; i1 < count; i1++) match = _mm_or_si128(match, _mm_cmpeq_epi8(block, _mm_set1_epi8((char)bytes[i1])));
+  return match;
+}
+
+static const char *ScanSpaceSSE2(const char *ptr, const char *end)
+{
+  const char *prefixEnd = (end - ptr > SCALAR_PREFIX ? ptr + SCALAR_PREFIX : end);
+  for(; ptr < prefixEnd; ptr++)
+  {
+    if(CharClasses[(unsigned char)*ptr] != CHAR_SPACE) return ptr;
+  }
+  for(; ptr + 16 <= end; ptr += 16)
+  {
+    __m128i block = _mm_loadu_si128((const __m128i*)ptr);
+    unsigned int mask = ~_mm_movemask_epi8(MatchAny16(block, spaceBytes, spaceCount)) & 0xFFFF;
+    if(mask != 0) return ptr + CountTrailingZeros(mask);
+  }
+  return ScanSpaceScalar(ptr, end);
+}
+
+static const char *ScanWordSSE2(const char *ptr, const char *end)
+{
+  const char *prefixEnd = (end - ptr > SCALAR_PREFIX ? ptr + SCALAR_PREFIX : end);
+  for(; ptr < prefixEnd; ptr++)
+  {
+    if(CharClasses[(unsigned char)*ptr] != CHAR_OTHER) return ptr;
+  }
+  for(; ptr + 16 <= end; ptr += 16)
+  {
+    __m128i block = _mm_loadu_si128((const __m128i*)ptr);
+    unsigned int mask = _mm_movemask_epi8(MatchAny16(block, wordStopBytes, wordStopCount));
+    if(mask != 0) return ptr + CountTrailingZeros(mask);
+  }
+  return ScanWordScalar(ptr, end);
+}
+
+static const char *ScanByteSSE2(const char *ptr, const char *end, char c)
+{
+  __m128i target = _mm_set1_epi8(c);
+  for(; ptr + 16 <= end; ptr += 16)
+  {
+    unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)ptr), target));
+    if(mask != 0) return ptr + CountTrailingZeros(mask);
+  }
+  return ptr;
+}
+
+static const char *ScanQuoteSSE2(const char *ptr, const char *end)
+{
+  __m128i quote = _mm_set1_epi8('\"');
+  __m128i backslash = _mm_set1_epi8('\\');
+  for(; ptr + 16 <= end; ptr += 16)
+  {
+    __m128i block = _mm_loadu_si128((const __m128i*)ptr);
+    unsigned int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash)));
+    if(mask != 0) return ptr + CountTrailingZeros(mask);
+  }
+  return ScanQuoteScalar(ptr, end);
+}
+
+static const char *ScanLineSSE2(const char *ptr, const char *end)
+{
+  return ScanLineScalar(ScanByteSSE2(ptr, end, '\n'), end);
+}
+#endif
+
+#ifdef RVM_SCAN_AVX2
+static inline TARGET_AVX2 __m256i MatchAny32(__m256i block, const unsigned char *bytes, int count)
+{
+  __m256i match = _mm256_setzero_si256();
+  for(int i1 = 0; i1 < count; i1++) match = _mm256_or_si256(match, _mm256_cmpeq_epi8(block, _mm256_set1_epi8((char)bytes[i1])));
+  return match;
+}
+
+static TARGET_AVX2 const char *ScanSpaceAVX2(const char *ptr, const char *end)
+{
+  const char *prefixEnd = (end - ptr > SCALAR_PREFIX ? ptr + SCALAR_PREFIX : end);
+  for(; ptr < prefixEnd; ptr++)
+  {
+    if(CharClasses[(unsigned char)*ptr] != CHAR_SPACE) return ptr;
+  }
+  for(; ptr + 32 <= end; ptr += 32)
+  {
+    __m256i block = _mm256_loadu_si256((const __m256i*)ptr);
+    unsigned int mask = ~(unsigned int)_mm256_movemask_epi8(MatchAny32(block, spaceBytes, spaceCount));
+    if(mask != 0) return ptr + CountTrailingZeros(mask);
+  }
+  return ScanSpaceScalar(ptr, end);
+}
+
+static TARGET_AVX2 const char *ScanWordAVX2(const char *ptr, const char *end)
+{
+  const char *prefixEnd = (end - ptr > SCALAR_PREFIX ? ptr + SCALAR_PREFIX : end);
+  for(; ptr < prefixEnd; ptr++)
+  {
+    if(CharClasses[(unsigned char)*ptr] != CHAR_OTHER) return ptr;
+  }
+  for(; ptr + 32 <= end; ptr += 32)
+  {
+    __m256i block = _mm256_loadu_si256((const __m256i*)ptr);
+    unsigned int mask = _mm256_movemask_epi8(MatchAny32(block, wordStopBytes, wordStopCount));
+    if(mask != 0) return ptr + CountTrailingZeros(mask);
+  }
+  return ScanWordScalar(ptr, end);
+}
+
+static TARGET_AVX2 const char *ScanByteAVX2(const char *ptr, const char *end, char c)
+{
+  __m256i target = _mm256_set1_epi8(c);
+  for(; ptr + 32 <= end; ptr += 32)
+  {
+    unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)ptr), target));
+    if(mask != 0) return ptr + CountTrailingZeros(mask);
+  }
+  return ptr;
+}
+
+static TARGET_AVX2 const char *ScanQuoteAVX2(const char *ptr, const char *end)
+{
+  __m256i quote = _mm256_set1_epi8('\"');
+  __m256i backslash = _mm256_set1_epi8('\\');
+  for(; ptr + 32 <= end; ptr += 32)
+  {
+    __m256i block = _mm256_loadu_si256((const __m256i*)ptr);
+    unsigned int mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(block, quote), _mm256_cmpeq_epi8(block, backslash)));
+    if(mask != 0) return ptr + CountTrailingZeros(mask);
+  }
+  return ScanQuoteScalar(ptr, end);
+}
+
+static TARGET_AVX2 const char *ScanLineAVX2(const char *ptr, const char *end)
+{
+  return ScanLineScalar(ScanByteAVX2(ptr, end, '\n'), end);
+}
+#endif
+
+static ScanLevel SupportedScanLevel()
+{
+#if defined(RVM_SCAN_AVX2)
+  if(__builtin_cpu_supports("avx2")) return SCAN_AVX2;
+  return SCAN_SSE2;
+#elif defined(RVM_SCAN_X86)
+  return SCAN_SSE2; //part of every x86-64 CPU
+#else
+  return SCAN_SCALAR;
+#endif
+}
+
+ScanLevel InitScanner(ScanLevel highest)
+{
+  spaceCount = 0;
+  wordStopCount = 0;
+  for(int i1 = 0; i1 < 128; i1++) //every byte from 128 up is CHAR_OTHER
+  {
+    if(CharClasses[i1] == CHAR_SPACE) spaceBytes[spaceCount++] = i1;
+    if(CharClasses[i1] != CHAR_OTHER) wordStopBytes[wordStopCount++] = i1;
+  }
+
+  ScanLevel level = SupportedScanLevel();
+  if(level > highest) level = highest;
+
+  ScanSpace = ScanSpaceScalar;
+  ScanWord = ScanWordScalar;
+  ScanQuote = ScanQuoteScalar;
+  ScanLine = ScanLineScalar;
+#ifdef RVM_SCAN_X86
+  if(level == SCAN_SSE2)
+  {
+    ScanSpace = ScanSpaceSSE2;
+    ScanWord = ScanWordSSE2;
+    ScanQuote = ScanQuoteSSE2;
+    ScanLine = ScanLineSSE2;
+  }
+#endif
+#ifdef RVM_SCAN_AVX2
+  if(level == SCAN_AVX2)
+  {
+    ScanSpace = ScanSpaceAVX2;
+    ScanWord = ScanWordAVX2;
+    ScanQuote = ScanQuoteAVX2;
+    ScanLine = ScanLineAVX2;
+  }
+#endif
+  return level;
+}
+
+const char *ScanLevelName(ScanLevel level)
+{
+  switch(level)
+  {
+    case SCAN_AVX2: return "avx2";
+    case SCAN_SSE2: return "sse2";
+    default: return "scalar";
+  }
+}
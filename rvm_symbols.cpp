@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "rvm_core.h"
+
+using namespace std;
+
+//Symbol files are text, one record per line:
+//  func <first offset> <end offset> <name>
+//  line <offset> <source line> <source column>
+//Offsets are into the .rexe, lines start at 1 in the file that was compiled.
+
+bool SaveSymbols(const char *path, const SymbolTable &symbols)
+{
+  FILE *file = fopen(path, "w");
+  if(file == NULL) return false;
+  for(size_t i1 = 0; i1 < symbols.functions.size(); i1++)
+  {
+    const Symbol &symbol = symbols.functions[i1];
+    fprintf(file, "func %u %u %s\n", symbol.address, symbol.end, symbol.name);
+  }
+  for(size_t i1 = 0; i1 < symbols.lines.size(); i1++)
+  {
+    const LineEntry &entry = symbols.lines[i1];
+    fprintf(file, "line %u %d %d\n", entry.address, entry.line, entry.column);
+  }
+  return fclose(file) == 0;
+}
+
+bool LoadSymbols(const char *path, SymbolTable &symbols)
+{
+  FILE *file = fopen(path, "r");
+  if(file == NULL) return false;
+
+  symbols.functions.clear();
+  symbols.lines.clear();
+  char line[256];
+  while(fgets(line, sizeof(line), file) != NULL)
+  {
+    Symbol symbol;
+    LineEntry entry;
+    if(sscanf(line, "func %u %u %31s", &symbol.address, &symbol.end, symbol.name) == 3) symbols.functions.push_back(symbol);
+    else if(sscanf(line, "line %u %d %d", &entry.address, &entry.line, &entry.column) == 3) symbols.lines.push_back(entry);
+  }
+  fclose(file);
+  return true;
+}
+
+const Symbol *FindFunction(const SymbolTable &symbols, int offset)
+{
+  for(size_t i1 = 0; i1 < symbols.functions.size(); i1++)
+  {
+    const Symbol &symbol = symbols.functions[i1];
+    if(offset >= (int)symbol.address && offset < (int)symbol.end) return &symbol;
+  }
+  return NULL;
+}
+
+const LineEntry *FindLine(const SymbolTable &symbols, int offset)
+{
+  const LineEntry *found = NULL;
+  for(size_t i1 = 0; i1 < symbols.lines.size() && (int)symbols.lines[i1].address <= offset; i1++)
+  {
+    found = &symbols.lines[i1];
+  }
+  return found;
+}
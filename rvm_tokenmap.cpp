@@ -43,15 +43,165 @@ bool token_compare(TokenType a, TokenType b)
   return a == b;
 }
 
+unsigned int HashBytes(const char *data, int length)
+{
+  unsigned int hash = 2166136261u;
+  for(int i1 = 0; i1 < length; i1++)
+  {
+    hash ^= (unsigned char)data[i1];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+unsigned int HashInt(int value)
+{
+  //mixes every bit into the low ones, which pick the slot
+  unsigned int hash = (unsigned int)value;
+  hash ^= hash >> 16;
+  hash *= 0x45d9f3bu;
+  hash ^= hash >> 16;
+  hash *= 0x45d9f3bu;
+  hash ^= hash >> 16;
+  return hash;
+}
+
+Arena::Arena(int chunkSize) : chunkSize(chunkSize), next(NULL), limit(NULL), used(0)
+{
+}
+
+Arena::~Arena()
+{
+  reset();
+  if(chunks.size() > 0) delete[] chunks[0];
+}
+
+void *Arena::alloc(int size)
+{
+  size = (size + 7) & ~7;
+  used += size;
+  if(size > chunkSize / 4) //big blocks are allocated on their own
+  {
+    char *block = new char[size];
+    blocks.push_back(block);
+    return block;
+  }
+  if(next == NULL || limit - next < size)
+  {
+    next = new char[chunkSize];
+    limit = next + chunkSize;
+    chunks.push_back(next);
+  }
+  void *result = next;
+  next += size;
+  return result;
+}
+
+char *Arena::copyString(const char *str, int length)
+{
+  char *copy = (char*)alloc(length + 1);
+  memcpy(copy, str, length);
+  copy[length] = '\0';
+  return copy;
+}
+
+void Arena::reset()
+{
+  for(int i1 = 0; i1 < blocks.size(); i1++) delete[] blocks[i1];
+  blocks.clear();
+  for(int i1 = 1; i1 < chunks.size(); i1++) delete[] chunks[i1];
+  if(chunks.size() > 1) chunks.resize(1);
+  next = (chunks.size() > 0 ? chunks[0] : NULL);
+  limit = (chunks.size() > 0 ? chunks[0] + chunkSize : NULL);
+  used = 0;
+}
+
+static unsigned int HashInternKey(InternKey key)
+{
+  return HashBytes(key.str, key.length);
+}
+
+static bool CompareInternKeys(InternKey a, InternKey b)
+{
+  return a.length == b.length && memcmp(a.str, b.str, a.length) == 0;
+}
+
+InternTable::InternTable(Arena *arena) : arena(arena), names(HashInternKey, CompareInternKeys)
+{
+}
+
+const char *InternTable::intern(const char *str, int length)
+{
+  InternKey key = { str, length };
+  const char **found = names.lookup(key);
+  if(found != NULL) return *found;
+  char *copy = arena->copyString(str, length);
+  key.str = copy; //the source may go away first
+  names.set(key, copy);
+  return copy;
+}
+
+unsigned char CharClasses[256];
+TokenType PunctTokens[256];
+
+//Perfect hash of the keywords: (first char + 3 * last char + length) & 15 is
+//different for each of them.  A new keyword has to get a free slot here and
+//a DEFINEKEYWORD below; PopulateTokenMap checks the two agree.
+typedef struct _KeywordSlot
+{
+  const char *word;
+  int length;
+  TokenType type;
+} KeywordSlot;
+
+static const KeywordSlot keywordSlots[16] =
+{
+  { NULL, 0, TOKEN_INVALID },
+  { NULL, 0, TOKEN_INVALID },
+  { "return", 6, TOKEN_RETURN },
+  { NULL, 0, TOKEN_INVALID },
+  { NULL, 0, TOKEN_INVALID },
+  { NULL, 0, TOKEN_INVALID },
+  { "void", 4, TOKEN_VOID },
+  { "float", 5, TOKEN_FLOAT },
+  { "int", 3, TOKEN_INT },
+  { NULL, 0, TOKEN_INVALID },
+  { "#include", 8, TOKEN_INCLUDE },
+  { "asm", 3, TOKEN_ASM },
+  { NULL, 0, TOKEN_INVALID },
+  { NULL, 0, TOKEN_INVALID },
+  { "string", 6, TOKEN_STRING },
+  { NULL, 0, TOKEN_INVALID },
+};
+
+static inline int KeywordHash(const char *str, int length)
+{
+  return ((unsigned char)str[0] + 3 * (unsigned char)str[length - 1] + length) & 15;
+}
+
+TokenType MatchKeyword(const char *str, int length)
+{
+  const KeywordSlot &slot = keywordSlots[KeywordHash(str, length)];
+  if(slot.length != length || memcmp(slot.word, str, length) != 0) return TOKEN_INVALID;
+  return slot.type;
+}
+
 bool populated = false;
 
-#define DEFINEANYWHERE(tok,enu) AnyWhereTokens.set(tok,enu);AnyWhereTokensReverse.set(enu,tok);
+#define DEFINEANYWHERE(tok,enu) AnyWhereTokens.set(tok,enu);AnyWhereTokensReverse.set(enu,tok);CharClasses[(unsigned char)tok[0]] = CHAR_PUNCT;PunctTokens[(unsigned char)tok[0]] = enu;
 #define DEFINEKEYWORD(tok,enu) KeywordTokens.set(tok,enu);KeywordTokensReverse.set(enu,tok);
 
 void PopulateTokenMap()
 {
   if(populated) return;
 
+  for(int i1 = 0; i1 < 256; i1++)
+  {
+    CharClasses[i1] = (i1 < 128 && isspace(i1) ? CHAR_SPACE : CHAR_OTHER);
+    PunctTokens[i1] = TOKEN_INVALID;
+  }
+  CharClasses[0] = CHAR_END;
+
   DEFINEANYWHERE(";", TOKEN_ENDSTATEMENT);
   DEFINEANYWHERE("(", TOKEN_LEFTPAREN);
   DEFINEANYWHERE(")", TOKEN_RIGHTPAREN);
@@ -73,6 +223,13 @@ void PopulateTokenMap()
   DEFINEKEYWORD("asm", TOKEN_ASM);
   DEFINEKEYWORD("return", TOKEN_RETURN);
 
+  for(int i1 = 0; i1 < KeywordTokens.size(); i1++)
+  {
+    pair<const char*, TokenType> &p = KeywordTokens.getAtIndex(i1);
+    if(MatchKeyword(p.first, strlen(p.first)) != p.second) throw runtime_error("Keyword hash table is missing a keyword");
+  }
+  InitScanner(SCAN_AVX2);
+
   populated = true;
 }
 
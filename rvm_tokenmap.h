@@ -43,6 +43,15 @@ enum TokenType
   TOKEN_RETURN,
 };
 
+//What a source character can start or end, for the scanner in CreateToken
+enum CharClass
+{
+  CHAR_OTHER = 0, //part of a symbol, number or keyword
+  CHAR_SPACE,
+  CHAR_PUNCT, //one of the AnyWhereTokens
+  CHAR_END, //'\0'
+};
+
 template <class K, class V>
 class ExactMap
 {
@@ -100,6 +109,161 @@ private:
   vector< pair <K, V> > values;
 };
 
+//Same interface as ExactMap, but keys are found through an open addressing
+//table (linear probing) of indexes into values, so lookups don't slow down
+//as the map grows.  values keeps insertion order for getAtIndex.  A key
+//changed through getAtIndex is only found again after reindex().
+template <class K, class V>
+class HashMap
+{
+public:
+  HashMap(unsigned int (*hsh)(K), bool (*cmp)(K, K)) : hasher(hsh), comparer(cmp), slots(NULL), slotCount(0)
+  {
+  }
+
+  ~HashMap()
+  {
+    delete[] slots;
+  }
+
+  V& operator [](const K key)
+  {
+    int idx = find(key);
+    if(idx < 0) throw runtime_error("Key not found");
+    return values[idx].second;
+  }
+
+  void set(const K key, const V value)
+  {
+    int idx = find(key);
+    if(idx >= 0)
+    {
+      values[idx].second = value;
+      return;
+    }
+    values.push_back(make_pair(key, value));
+    if(values.size() * 2 > slotCount) resize(slotCount == 0 ? 16 : slotCount * 2); //at most half full
+    else insertSlot(values.size() - 1);
+  }
+
+  pair<K, V>& getAtIndex(int idx)
+  {
+    if(idx >= values.size() || idx < 0) throw runtime_error("Out of bounds");
+    return values[idx];
+  }
+
+  size_t size() { return values.size(); }
+
+  bool contains(const K key)
+  {
+    return find(key) >= 0;
+  }
+
+  V* lookup(const K key) //NULL if not found
+  {
+    int idx = find(key);
+    return (idx < 0 ? NULL : &values[idx].second);
+  }
+
+  void clear()
+  {
+    values.clear();
+    for(int i1 = 0; i1 < slotCount; i1++) slots[i1] = -1;
+  }
+
+  void reindex()
+  {
+    resize(slotCount);
+  }
+
+private:
+  HashMap(const HashMap&);
+  HashMap& operator=(const HashMap&);
+
+  int find(const K key)
+  {
+    if(slotCount == 0) return -1;
+    for(unsigned int i1 = hasher(key) & (slotCount - 1); slots[i1] >= 0; i1 = (i1 + 1) & (slotCount - 1))
+    {
+      if(comparer(values[slots[i1]].first, key)) return slots[i1];
+    }
+    return -1;
+  }
+
+  void insertSlot(int idx)
+  {
+    unsigned int i1 = hasher(values[idx].first) & (slotCount - 1);
+    while(slots[i1] >= 0) i1 = (i1 + 1) & (slotCount - 1);
+    slots[i1] = idx;
+  }
+
+  void resize(int count) //count is a power of two
+  {
+    delete[] slots;
+    slots = new int[count];
+    slotCount = count;
+    for(int i1 = 0; i1 < slotCount; i1++) slots[i1] = -1;
+    for(int i1 = 0; i1 < values.size(); i1++) insertSlot(i1);
+  }
+
+  unsigned int (*hasher)(K);
+  bool (*comparer)(K, K);
+  vector< pair <K, V> > values;
+  int *slots; //index into values, -1 when empty
+  int slotCount;
+};
+
+extern unsigned int HashBytes(const char *data, int length); //FNV-1a
+extern unsigned int HashInt(int value);
+
+//Bump allocator for memory that lives as long as one compilation.  Nothing
+//is freed on its own; reset() gives everything back at once and keeps the
+//first chunk for the next compilation.
+class Arena
+{
+public:
+  Arena(int chunkSize = 64 * 1024);
+  ~Arena();
+  void *alloc(int size); //8 byte aligned
+  char *copyString(const char *str, int length); //'\0' terminated
+  void reset();
+  size_t bytesUsed() { return used; }
+  size_t chunkCount() { return chunks.size() + blocks.size(); }
+
+private:
+  Arena(const Arena&);
+  Arena& operator=(const Arena&);
+
+  vector<char*> chunks; //chunkSize each, the first is kept by reset()
+  vector<char*> blocks; //too big for a chunk
+  int chunkSize;
+  char *next; //free space in the last chunk
+  char *limit;
+  size_t used;
+};
+
+typedef struct _InternKey
+{
+  const char *str;
+  int length;
+} InternKey;
+
+//Keeps one '\0' terminated copy of every name in an Arena, so two names are
+//the same exactly when their pointers are.  clear() must go with a reset()
+//of the arena.
+class InternTable
+{
+public:
+  InternTable(Arena *arena);
+  const char *intern(const char *str, int length);
+  void clear() { names.clear(); }
+  size_t size() { return names.size(); }
+
+private:
+  Arena *arena;
+  HashMap<InternKey, const char*> names;
+};
+
 extern bool cmp_token_exists(const char *a, const char *b);
 extern bool cmp_token_exists_space_or_token_follows(const char *a, const char *b);
 extern bool token_compare(TokenType a, TokenType b);
@@ -109,7 +273,30 @@ extern ExactMap<const char*, TokenType> KeywordTokens;
 extern ExactMap<TokenType, const char*> AnyWhereTokensReverse;
 extern ExactMap<TokenType, const char*> KeywordTokensReverse;
 
+extern unsigned char CharClasses[256]; //CharClass of every byte
+extern TokenType PunctTokens[256]; //token of every CHAR_PUNCT byte
+
 extern void PopulateTokenMap();
+extern TokenType MatchKeyword(const char *str, int length); //TOKEN_INVALID if str is not a keyword
+
+//Source scanning kernels (rvm_scan.cpp).  Each returns the first byte in
+//[ptr, end) that ends the run it skips, or end.  PopulateTokenMap points them
+//at the widest version the CPU supports; -DRVM_NO_SIMD keeps them scalar.
+enum ScanLevel
+{
+  SCAN_SCALAR = 0,
+  SCAN_SSE2,
+  SCAN_AVX2,
+};
+
+typedef const char *(*ScanFunction)(const char *ptr, const char *end);
+extern ScanFunction ScanSpace; //skips CHAR_SPACE bytes
+extern ScanFunction ScanWord; //skips CHAR_OTHER bytes
+extern ScanFunction ScanQuote; //finds the next '"' or '\\', so escapes are seen in the same pass
+extern ScanFunction ScanLine; //finds the next '\n'
+
+extern ScanLevel InitScanner(ScanLevel highest); //picks the kernels, returns the level used
+extern const char *ScanLevelName(ScanLevel level);
 
 extern bool TokenIsDataType(TokenType type);
 extern bool TokenIsMathOp(TokenType type);
@@ -0,0 +1,312 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdexcept>
+#include <vector>
+#include "rvm_core.h"
+
+using namespace std;
+
+//The instruction set has no conditional branches, so every function body is
+//straight line code from its PUSHFRAME or ENTER to its POPFRAME or RET, with calls
+//(INST_JMP or INST_CALL) in between.  That makes the walk below exact: it simulates each function once,
+//with operand stack depths relative to the depth at the call, and reuses the
+//result at every later call site.
+
+typedef struct _FunctionSummary
+{
+  bool done;
+  bool noReturn; //ends the program or recurses forever
+  int delta;
+  int peak;
+  int peakAt; //offset of the instruction that reached peak
+  int trough;
+  int troughAt;
+} FunctionSummary;
+
+typedef struct _Activation
+{
+  int entry; //index of the PUSHFRAME, -1 for the top level
+  int ip;
+  int depth;
+  int locals;
+  int peak;
+  int peakAt;
+  int trough;
+  int troughAt;
+} Activation;
+
+static void VerifyError(int offset, const char *format, ...)
+{
+  char message[256];
+  int len = snprintf(message, sizeof(message), "Verify Error at offset %d: ", offset);
+  va_list ap;
+  va_start(ap, format);
+  vsnprintf(message + len, sizeof(message) - len, format, ap);
+  va_end(ap);
+  throw runtime_error(message);
+}
+
+//Operand stack values an instruction needs and leaves behind, false if the
+//verifier does not know the instruction
+static bool StackEffect(int opcode, int *pops, int *pushes)
+{
+  *pops = 0;
+  *pushes = 0;
+  switch(opcode)
+  {
+    case INST_PUSH:
+    case INST_PUSHA:
+    case INST_PUSHC:
+    case INST_ADDAA:
+    case INST_ADDAC:
+      *pushes = 1;
+      return true;
+    case INST_POP:
+    case INST_POPA:
+    case INST_PRINT:
+    case INST_DECLPOPA:
+    case INST_ADDAPOPA:
+    case INST_ADDCPOPA:
+      *pops = 1;
+      return true;
+    case INST_ADDS:
+      *pops = 2;
+      *pushes = 1;
+      return true;
+    case INST_ADDA:
+    case INST_ADDC:
+      *pops = 1;
+      *pushes = 1;
+      return true;
+    case INST_ADDSPOPA:
+      *pops = 2;
+      return true;
+    case INST_PUSHVAR:
+    case INST_MOVA:
+    case INST_ADDAAPOPA:
+    case INST_ADDACPOPA:
+    case INST_PRINTA:
+    case INST_SETC:
+    case INST_DECLC:
+    case INST_YIELD:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static inline void CheckLocal(Activation &act, int offset, int idx)
+{
+  if(act.entry < 0) VerifyError(offset, "local variable used outside of a function");
+  if(idx >= act.locals) VerifyError(offset, "local %d used but only %d declared", idx, act.locals);
+}
+
+static inline void SetDepth(Activation &act, int offset, int depth)
+{
+  act.depth = depth;
+  if(depth > act.peak)
+  {
+    act.peak = depth;
+    act.peakAt = offset;
+  }
+  if(depth < act.trough)
+  {
+    act.trough = depth;
+    act.troughAt = offset;
+  }
+}
+
+static Activation NewActivation(int entry, int ip)
+{
+  Activation act;
+  act.entry = entry;
+  act.ip = ip;
+  act.depth = 0;
+  act.locals = 0;
+  act.peak = 0;
+  act.peakAt = 0;
+  act.trough = 0;
+  act.troughAt = 0;
+  return act;
+}
+
+//Checks every instruction reachable from the program entry and rejects the
+//program with a diagnostic if it could trap, jump somewhere other than a
+//function entry, touch an undeclared local, or overflow or underflow the
+//operand stack.  On success the operand of every reachable PUSHFRAME holds
+//the number of locals that function declares, like the operand of ENTER, so
+//the frame can be reserved in one step and the interpreter needs no
+//per-instruction checks.
+void VerifyProgram(char *bytecode, int size, vector<DecodedInstruction> &code, const vector<int> &offsets, int stackLimit, int *maxStack)
+{
+  vector<FunctionSummary> summaries(code.size());
+  vector<int> activeAt(code.size(), -1); //activation index of functions being walked
+  vector<int> argCount(code.size(), -1); //arguments each function is called with
+  for(size_t i1 = 0; i1 < summaries.size(); i1++) summaries[i1].done = false;
+
+  vector<Activation> calls;
+  calls.push_back(NewActivation(-1, 0));
+
+  while(!calls.empty())
+  {
+    Activation &act = calls.back();
+    DecodedInstruction &inst = code[act.ip];
+    int offset = offsets[act.ip];
+    bool returns = false;
+    bool ends = false;
+
+    switch(inst.opcode)
+    {
+      case DECODED_INVALID:
+      {
+        if(InstructionLength(bytecode[offset]) == 0 || offset + InstructionLength(bytecode[offset]) > size)
+          VerifyError(offset, "invalid instruction 0x%02x", (unsigned char)bytecode[offset]);
+        VerifyError(offset, "instruction 0x%02x is not implemented", (unsigned char)bytecode[offset]);
+        break;
+      }
+      case DECODED_HALT:
+      {
+        ends = true; //runs off the end of the program
+        break;
+      }
+      case INST_PUSHFRAME:
+      case INST_ENTER:
+      {
+        VerifyError(offset, "%s is only valid as the first instruction of a function", inst.opcode == INST_ENTER ? "ENTER" : "PUSHFRAME");
+        break;
+      }
+      case INST_POPFRAME:
+      case INST_RET:
+      {
+        if(act.entry < 0) ends = true; //the top level has no frame, execution stops
+        else returns = true;
+        break;
+      }
+      case INST_JMP:
+      case INST_CALL:
+      {
+        int target = BYTES2INT(&bytecode[offset + 1]);
+        int args = (inst.opcode == INST_CALL ? inst.operand2 : 0); //JMP callers move arguments in the callee
+        if(target < 0 || target >= size) VerifyError(offset, "jump target %d is outside the program", target);
+        DecodedInstruction &entry = code[inst.operand];
+        if(entry.opcode != INST_PUSHFRAME && entry.opcode != INST_ENTER) VerifyError(offset, "jump target %d is not a function entry", target);
+        if(entry.opcode == INST_ENTER && entry.operand < args)
+          VerifyError(offset, "function at %d has %d locals but is called with %d arguments", target, entry.operand, args);
+        if(argCount[inst.operand] < 0) argCount[inst.operand] = args;
+        else if(argCount[inst.operand] != args)
+          VerifyError(offset, "function at %d called with %d arguments, elsewhere with %d", target, args, argCount[inst.operand]);
+
+        if(activeAt[inst.operand] >= 0) //recursion, which never returns without branches
+        {
+          int growth = -args;
+          for(size_t i1 = activeAt[inst.operand]; i1 < calls.size(); i1++) growth += calls[i1].depth;
+          if(growth > 0) VerifyError(offset, "recursive call grows the operand stack by %d values per call", growth);
+          if(growth < 0) VerifyError(offset, "recursive call shrinks the operand stack by %d values per call", -growth);
+          ends = true;
+          break;
+        }
+        if(!summaries[inst.operand].done)
+        {
+          activeAt[inst.operand] = calls.size();
+          calls.push_back(NewActivation(inst.operand, inst.operand + 1));
+          calls.back().locals = (entry.opcode == INST_ENTER ? entry.operand : args);
+          continue; //act is no longer valid
+        }
+
+        SetDepth(act, offset, act.depth - args);
+        FunctionSummary &callee = summaries[inst.operand];
+        if(act.depth + callee.peak > act.peak)
+        {
+          act.peak = act.depth + callee.peak;
+          act.peakAt = callee.peakAt;
+        }
+        if(act.depth + callee.trough < act.trough)
+        {
+          act.trough = act.depth + callee.trough;
+          act.troughAt = callee.troughAt;
+        }
+        act.depth += callee.delta;
+        if(callee.noReturn || act.entry < 0) ends = true; //the top level calls into the root frame
+        else act.ip++;
+        break;
+      }
+      default:
+      {
+        int pops, pushes;
+        if(!StackEffect(inst.opcode, &pops, &pushes)) VerifyError(offset, "instruction 0x%02x is not supported", inst.opcode);
+
+        switch(inst.opcode)
+        {
+          case INST_PUSHVAR:
+          case INST_DECLPOPA:
+          case INST_DECLC:
+            if(act.entry < 0) VerifyError(offset, "local variable declared outside of a function");
+            if(code[act.entry].opcode == INST_PUSHFRAME) act.locals++; //ENTER declared them all up front
+            break;
+        }
+        switch(inst.opcode)
+        {
+          case INST_PUSHA:
+          case INST_POPA:
+          case INST_DECLPOPA:
+          case INST_ADDA:
+          case INST_PRINTA:
+          case INST_SETC:
+          case INST_ADDAC:
+          case INST_DECLC:
+          case INST_ADDSPOPA:
+            CheckLocal(act, offset, inst.operand);
+            break;
+          case INST_MOVA:
+          case INST_ADDAA:
+          case INST_ADDAPOPA:
+            CheckLocal(act, offset, inst.operand);
+            CheckLocal(act, offset, inst.operand2);
+            break;
+          case INST_ADDCPOPA:
+            CheckLocal(act, offset, inst.operand2);
+            break;
+          case INST_ADDAAPOPA:
+            CheckLocal(act, offset, inst.operand);
+            CheckLocal(act, offset, inst.operand2);
+            CheckLocal(act, offset, inst.operand3);
+            break;
+          case INST_ADDACPOPA:
+            CheckLocal(act, offset, inst.operand);
+            CheckLocal(act, offset, inst.operand3);
+            break;
+        }
+
+        SetDepth(act, offset, act.depth - pops);
+        SetDepth(act, offset, act.depth + pushes);
+        act.ip++;
+        break;
+      }
+    }
+
+    if(!returns && !ends) continue;
+
+    Activation done = act;
+    calls.pop_back();
+    if(done.entry < 0)
+    {
+      if(done.trough < 0) VerifyError(done.troughAt, "operand stack underflow");
+      if(done.peak > stackLimit) VerifyError(done.peakAt, "operand stack needs %d values, the limit is %d", done.peak, stackLimit);
+      *maxStack = done.peak;
+      break;
+    }
+
+    FunctionSummary &summary = summaries[done.entry];
+    summary.done = true;
+    summary.noReturn = ends;
+    summary.delta = done.depth;
+    summary.peak = done.peak;
+    summary.peakAt = done.peakAt;
+    summary.trough = done.trough;
+    summary.troughAt = done.troughAt;
+    activeAt[done.entry] = -1;
+    if(code[done.entry].opcode == INST_PUSHFRAME) code[done.entry].operand = done.locals;
+  }
+}